@@ -0,0 +1,140 @@
+#!/usr/bin/env python
+#
+# Copyright 2008 Evenflow, Inc.
+#
+# mock-download-server.py
+# Flaky HTTP server for testing the dropbox CLI's daemon download.
+#
+# This file is part of nautilus-dropbox.
+#
+# nautilus-dropbox is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# nautilus-dropbox is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Serves one blob at every URL the way the download server does as far
+# as download_file_ranged cares: "Range: bytes=a-b" gets a 206 with a
+# Content-Range, anything else a 200, and every response carries an
+# ETag.  Some responses are cut short on purpose to look like dropped
+# connections.  tests/test-download.py runs it in process; run on its
+# own it serves until ^C:
+#
+#   $ ./mock-download-server.py --port 8000 --size 20000000 --cut-rate 0.3
+
+import BaseHTTPServer
+import optparse
+import random
+import re
+import SocketServer
+import sys
+import time
+
+class Handler(BaseHTTPServer.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.0'
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        server = self.server
+        data = server.data
+        m = re.match(r'bytes=(\d+)-(\d*)$', self.headers.get('Range', ''))
+        if m and server.ranges:
+            start = int(m.group(1))
+            end = int(m.group(2)) if m.group(2) else len(data) - 1
+            end = min(end, len(data) - 1)
+            self.send_response(206)
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, end, len(data)))
+        else:
+            start, end = 0, len(data) - 1
+            self.send_response(200)
+        self.send_header('Content-Length', str(end - start + 1))
+        self.send_header('ETag', '"%s"' % server.etag)
+        self.end_headers()
+
+        body = data[start:end + 1]
+        # never cut the one byte probe, that's just an unreachable server.
+        # Cut every 1/cut_rate-th response rather than at random, so a
+        # short test run is sure to see some
+        if len(body) > 1 and server.cut_rate > 0:
+            server.cut_credit += server.cut_rate
+            if server.cut_credit >= 1.0:
+                server.cut_credit -= 1.0
+                server.cuts += 1
+                body = body[:random.randint(0, len(body) // 2)]
+        server.served += 1
+        for i in range(0, len(body), 65536):
+            self.wfile.write(body[i:i + 65536])
+            if server.delay:
+                time.sleep(server.delay)
+
+class MockDownloadServer(SocketServer.ThreadingMixIn, BaseHTTPServer.HTTPServer):
+    daemon_threads = True
+
+    def __init__(self, port, data, cut_rate=0.0, ranges=True, etag='v1', delay=0.0):
+        BaseHTTPServer.HTTPServer.__init__(self, ('127.0.0.1', port), Handler)
+        self.data = data
+        self.cut_rate = cut_rate
+        self.ranges = ranges
+        self.etag = etag
+        self.delay = delay
+        self.served = 0
+        self.cuts = 0
+        self.cut_credit = 0.0
+
+    def handle_error(self, request, client_address):
+        # clients hang up on us all the time, that's the point
+        pass
+
+    def url(self):
+        return 'http://127.0.0.1:%d/download' % self.server_address[1]
+
+def random_blob(size, seed=0):
+    rng = random.Random(seed)
+    return ''.join(chr(rng.getrandbits(8)) for i in xrange(size))
+
+def main(argv):
+    parser = optparse.OptionParser(usage="%prog [options]")
+    parser.add_option("--port", type="int", default=8000,
+                      help="port to listen on, on 127.0.0.1 (0: any free one)")
+    parser.add_option("--file", default=None,
+                      help="serve this file (default: --size random bytes)")
+    parser.add_option("--size", type="int", default=1 << 20,
+                      help="size of the random blob served without --file")
+    parser.add_option("--cut-rate", type="float", default=0.0,
+                      help="fraction of responses cut short")
+    parser.add_option("--no-ranges", action="store_true", default=False,
+                      help="ignore Range headers like a server without range support")
+    parser.add_option("--etag", default="v1",
+                      help="ETag to send with every response")
+    parser.add_option("--delay", type="float", default=0.01,
+                      help="seconds to sleep after every 64k written")
+    opts, args = parser.parse_args(argv[1:])
+
+    if opts.file is not None:
+        with open(opts.file, 'rb') as f:
+            data = f.read()
+    else:
+        data = random_blob(opts.size)
+
+    server = MockDownloadServer(opts.port, data, opts.cut_rate,
+                                not opts.no_ranges, opts.etag, opts.delay)
+    print server.url()
+    sys.stdout.flush()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print "%d responses, %d cut short" % (server.served, server.cuts)
+
+if __name__ == '__main__':
+    main(sys.argv)
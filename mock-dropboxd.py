@@ -0,0 +1,334 @@
+#!/usr/bin/env python
+#
+# Copyright 2008 Evenflow, Inc.
+#
+# mock-dropboxd.py
+# Fake Dropbox daemon for benchmarking and testing nautilus-dropbox.
+#
+# This file is part of nautilus-dropbox.
+#
+# nautilus-dropbox is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# nautilus-dropbox is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Listens on command_socket and iface_socket under <home>/.dropbox and
+# speaks the same line protocol as the real daemon, so the extension (or
+# the dropbox CLI) can be pointed at it with HOME=<home>.
+#
+#   command_socket: "<command>\n" ("key\tval\tval...\n")* "done\n"
+#                   answered by "ok\n" (args) "done\n" or error lines + "done\n"
+#   iface_socket:   we push "<hook>\n" (args) "done\n"
+#
+# Keys and values escape only '\\', '\n' and '\t'.
+
+import optparse
+import os
+import random
+import socket
+import sys
+import threading
+import time
+
+def sanitize(s):
+    return s.replace('\\', '\\\\').replace('\n', '\\n').replace('\t', '\\t')
+
+def desanitize(s):
+    out = []
+    i = 0
+    while i < len(s):
+        c = s[i]
+        if c == '\\' and i + 1 < len(s):
+            i += 1
+            c = {'n': '\n', 't': '\t'}.get(s[i], s[i])
+        out.append(c)
+        i += 1
+    return ''.join(out)
+
+def format_args(args):
+    # an empty value list still needs its tab, a bare key is a parse
+    # error to the extension
+    lines = ['\t'.join([sanitize(k)] + ([sanitize(x) for x in v] or ['']))
+             for k, v in args]
+    lines.append('done')
+    return '\n'.join(lines) + '\n'
+
+def format_message(name, args):
+    return sanitize(name) + '\n' + format_args(args)
+
+class Stats(object):
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.commands = {}
+        self.errors = 0
+        self.drops = 0
+        self.touches = 0
+
+    def count(self, name):
+        self.lock.acquire()
+        try:
+            self.commands[name] = self.commands.get(name, 0) + 1
+        finally:
+            self.lock.release()
+
+    def bump(self, counter):
+        # the command, hook and burst threads all count
+        self.lock.acquire()
+        try:
+            setattr(self, counter, getattr(self, counter) + 1)
+        finally:
+            self.lock.release()
+
+    def dump(self, f=sys.stderr):
+        self.lock.acquire()
+        try:
+            for name in sorted(self.commands):
+                f.write("%8d %s\n" % (self.commands[name], name))
+            f.write("%8d errors injected\n" % self.errors)
+            f.write("%8d connections dropped\n" % self.drops)
+            f.write("%8d shell_touch sent\n" % self.touches)
+        finally:
+            self.lock.release()
+
+class MockDaemon(object):
+    def __init__(self, opts):
+        self.opts = opts
+        self.stats = Stats()
+        self.hook_clients = []
+        self.hook_lock = threading.Lock()
+        # long option strings make for big icon_overlay_context_options replies
+        self.menu = ['Mock Action %d~Mock tooltip number %d~mock-action-%d' % (i, i, i)
+                     for i in range(opts.menu_size)]
+
+    def sleep(self):
+        if self.opts.latency or self.opts.jitter:
+            delay = self.opts.latency + random.uniform(0, self.opts.jitter)
+            time.sleep(delay / 1000.0)
+
+    def in_root(self, path):
+        return path == self.opts.root or path.startswith(self.opts.root.rstrip('/') + '/')
+
+    def reply(self, name, args):
+        paths = args.get('path', []) + args.get('paths', [])
+        if name == 'icon_overlay_file_status':
+            if paths and self.in_root(paths[0]):
+                return [('status', [self.opts.status])]
+            return [('status', ['unwatched'])]
+        elif name == 'get_folder_tag':
+            return [('tag', [self.opts.tag])]
+        elif name == 'get_emblems':
+            if not self.opts.emblems:
+                # like a daemon without get_emblems, the client falls
+                # back to icon_overlay_file_status
+                return None
+            return [('emblems', ['mock-emblem-%d' % i for i in range(self.opts.emblems)])]
+        elif name == 'icon_overlay_context_options':
+            return [('options', self.menu)]
+        elif name == 'icon_overlay_context_action':
+            return []
+        elif name == 'get_emblem_paths':
+            return [('path', self.opts.emblem_path)]
+        elif name == 'get_dropbox_folder':
+            return [('path', [self.opts.root])]
+        elif name == 'get_dropbox_status':
+            return [('status', ['Up to date'])]
+        return None
+
+    def serve_command(self, conn):
+        f = conn.makefile('rwb' if sys.version_info[0] >= 3 else 'r+')
+        def readline():
+            line = f.readline()
+            if not line:
+                raise EOFError()
+            if not isinstance(line, str):
+                line = line.decode('utf8')
+            return line.rstrip('\n')
+        def write(s):
+            f.write(s.encode('utf8') if sys.version_info[0] >= 3 else s)
+            f.flush()
+
+        try:
+            while True:
+                name = desanitize(readline())
+                args = {}
+                while True:
+                    line = readline()
+                    if line == 'done':
+                        break
+                    fields = [desanitize(x) for x in line.split('\t')]
+                    args[fields[0]] = fields[1:]
+
+                self.stats.count(name)
+                self.sleep()
+
+                if random.random() < self.opts.drop_rate:
+                    # look like a daemon restart, the client has to
+                    # fail the request and reconnect both sockets
+                    self.stats.bump('drops')
+                    self.drop_hook_clients()
+                    break
+
+                if random.random() < self.opts.error_rate:
+                    self.stats.bump('errors')
+                    write('notok\ninjected error\ndone\n')
+                    continue
+
+                response = self.reply(name, args)
+                if response is None:
+                    write('notok\nunknown command %s\ndone\n' % sanitize(name))
+                else:
+                    write('ok\n' + format_args(response))
+        except (EOFError, socket.error):
+            pass
+        finally:
+            conn.close()
+
+    def drop_hook_clients(self):
+        self.hook_lock.acquire()
+        try:
+            for conn in self.hook_clients:
+                conn.close()
+            self.hook_clients = []
+        finally:
+            self.hook_lock.release()
+
+    def push(self, name, args):
+        msg = format_message(name, args)
+        if sys.version_info[0] >= 3:
+            msg = msg.encode('utf8')
+        self.hook_lock.acquire()
+        try:
+            for conn in list(self.hook_clients):
+                try:
+                    conn.sendall(msg)
+                except socket.error:
+                    self.hook_clients.remove(conn)
+        finally:
+            self.hook_lock.release()
+
+    def touch_bursts(self):
+        i = 0
+        while True:
+            time.sleep(self.opts.touch_interval)
+            for j in range(self.opts.touch_burst):
+                path = os.path.join(self.opts.root, 'file-%d' % ((i + j) % self.opts.touch_files))
+                if self.opts.odd_pushes and j % 4 == 1:
+                    path += '\twith\nodd\\chars'
+                if self.opts.odd_pushes and j % 10 == 9:
+                    self.push('shell_emblems' if self.opts.push_emblems else 'shell_touch',
+                              [('path', []), ('emblems', [])])
+                elif self.opts.push_emblems:
+                    self.push('shell_emblems', [('path', [path]),
+                                                ('emblems', ['mock-emblem-%d' % (i % 4)])])
+                else:
+                    self.push('shell_touch', [('path', [path])])
+                self.stats.bump('touches')
+            i += self.opts.touch_burst
+
+    def listen(self, path, handler):
+        if os.path.exists(path):
+            os.unlink(path)
+        s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        s.bind(path)
+        s.listen(16)
+        def accept_loop():
+            while True:
+                conn, _ = s.accept()
+                t = threading.Thread(target=handler, args=(conn,))
+                t.daemon = True
+                t.start()
+        t = threading.Thread(target=accept_loop)
+        t.daemon = True
+        t.start()
+
+    def serve_hook(self, conn):
+        self.hook_lock.acquire()
+        try:
+            self.hook_clients.append(conn)
+        finally:
+            self.hook_lock.release()
+
+    def run(self):
+        dotdir = os.path.join(self.opts.home, '.dropbox')
+        if not os.path.isdir(dotdir):
+            os.makedirs(dotdir)
+        self.listen(os.path.join(dotdir, 'command_socket'), self.serve_command)
+        self.listen(os.path.join(dotdir, 'iface_socket'), self.serve_hook)
+        # "dropbox running" and the commands that need the daemon look
+        # here, and our command line has "dropbox" in it like theirs
+        with open(os.path.join(dotdir, 'dropbox.pid'), 'w') as f:
+            f.write('%d\n' % os.getpid())
+
+        if self.opts.touch_burst:
+            t = threading.Thread(target=self.touch_bursts)
+            t.daemon = True
+            t.start()
+
+        try:
+            if self.opts.duration:
+                time.sleep(self.opts.duration)
+            else:
+                while True:
+                    time.sleep(3600)
+        except KeyboardInterrupt:
+            pass
+        self.stats.dump()
+
+def main(argv):
+    parser = optparse.OptionParser(usage="%prog [options]")
+    parser.add_option("--home", default=os.path.expanduser("~"),
+                      help="serve sockets under HOME/.dropbox (default: ~)")
+    parser.add_option("--root", default=None,
+                      help="Dropbox folder to report (default: HOME/Dropbox)")
+    parser.add_option("--latency", type="float", default=0.0,
+                      help="milliseconds to wait before each reply")
+    parser.add_option("--jitter", type="float", default=0.0,
+                      help="extra random milliseconds (uniform) per reply")
+    parser.add_option("--error-rate", type="float", default=0.0,
+                      help="fraction of commands answered with an error")
+    parser.add_option("--drop-rate", type="float", default=0.0,
+                      help="fraction of commands after which all connections are dropped")
+    parser.add_option("--status", default="up to date",
+                      help="icon_overlay_file_status reply for files in the root")
+    parser.add_option("--tag", default="",
+                      help="get_folder_tag reply")
+    parser.add_option("--emblems", type="int", default=0,
+                      help="number of emblems in get_emblems replies "
+                      "(default 0: get_emblems is an unknown command)")
+    parser.add_option("--menu-size", type="int", default=3,
+                      help="number of items in icon_overlay_context_options replies")
+    parser.add_option("--emblem-path", action="append", default=[],
+                      help="directory reported by get_emblem_paths (repeatable, "
+                      "default: data/emblems next to this script)")
+    parser.add_option("--touch-burst", type="int", default=0,
+                      help="shell_touch messages to push per burst")
+    parser.add_option("--touch-interval", type="float", default=1.0,
+                      help="seconds between shell_touch bursts")
+    parser.add_option("--touch-files", type="int", default=1000,
+                      help="cycle bursts over this many file names in the root")
+    parser.add_option("--push-emblems", action="store_true", default=False,
+                      help="push shell_emblems instead of shell_touch")
+    parser.add_option("--odd-pushes", action="store_true", default=False,
+                      help="put a tab, a newline and a backslash in every fourth "
+                      "pushed file name and leave path and emblems empty in every tenth")
+    parser.add_option("--duration", type="float", default=0.0,
+                      help="exit after this many seconds (default: run until ^C)")
+    opts, args = parser.parse_args(argv[1:])
+    if opts.root is None:
+        opts.root = os.path.join(opts.home, 'Dropbox')
+    if not opts.emblem_path:
+        opts.emblem_path = [os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                         'data', 'emblems')]
+    MockDaemon(opts).run()
+
+if __name__ == '__main__':
+    main(sys.argv)
@@ -0,0 +1,18 @@
+import os
+import sys
+import gtk
+
+# usage: scaleemblems.py OUTDIR SIZES EMBLEM.png...
+# writes OUTDIR/NxN/EMBLEM.png for every N in the comma separated SIZES
+
+if __name__ == '__main__':
+    outdir = sys.argv[1]
+    sizes = [int(size) for size in sys.argv[2].split(',')]
+    for path in sys.argv[3:]:
+        pixbuf = gtk.gdk.pixbuf_new_from_file(path)
+        for size in sizes:
+            sizedir = os.path.join(outdir, "%dx%d" % (size, size))
+            if not os.path.isdir(sizedir):
+                os.makedirs(sizedir)
+            scaled = pixbuf.scale_simple(size, size, gtk.gdk.INTERP_HYPER)
+            scaled.save(os.path.join(sizedir, os.path.basename(path)), "png")
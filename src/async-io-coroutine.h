@@ -24,6 +24,10 @@
 #ifndef ASYNC_IO_COROUTINE_H
 #define ASYNC_IO_COROUTINE_H
 
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <glib.h>
 
 G_BEGIN_DECLS
@@ -60,6 +64,110 @@ G_BEGIN_DECLS
     }								\
   }
 
+/*
+  A line reader that pulls big chunks off a non-blocking fd with one
+  read() and hands out lines in place, the line returned is only valid
+  until the next call.
+
+  The buffer starts out at CR_LINE_READER_SIZE, which fits anything the
+  daemon normally sends, and doubles for longer lines up to
+  CR_LINE_READER_MAX.  A line longer than that is an error and sets
+  overlong so the caller can tell it apart from a broken connection.
+  Resetting the reader shrinks the buffer back.
+*/
+#define CR_LINE_READER_SIZE 16384
+#define CR_LINE_READER_MAX (1024 * 1024)
+
+typedef struct {
+  gchar *buf;
+  gsize size;
+  gsize start;
+  gsize end;
+  gboolean overlong;
+} CRLineReader;
+
+static inline void
+cr_line_reader_reset(CRLineReader *reader) {
+  if (reader->buf == NULL || reader->size != CR_LINE_READER_SIZE) {
+    g_free(reader->buf);
+    reader->buf = g_malloc(CR_LINE_READER_SIZE);
+    reader->size = CR_LINE_READER_SIZE;
+  }
+  reader->start = reader->end = 0;
+  reader->overlong = FALSE;
+}
+
+static inline void
+cr_line_reader_init(CRLineReader *reader) {
+  reader->buf = NULL;
+  cr_line_reader_reset(reader);
+}
+
+static inline GIOStatus
+cr_line_reader_read_line(CRLineReader *reader, int fd, gchar **line) {
+  while (1) {
+    gchar *newline;
+    ssize_t bytes_read;
+
+    newline = memchr(reader->buf + reader->start, '\n',
+		     reader->end - reader->start);
+    if (newline != NULL) {
+      *newline = '\0';
+      *line = reader->buf + reader->start;
+      reader->start = newline - reader->buf + 1;
+      return G_IO_STATUS_NORMAL;
+    }
+
+    /* make room for the rest of the line */
+    if (reader->start > 0) {
+      memmove(reader->buf, reader->buf + reader->start,
+	      reader->end - reader->start);
+      reader->end -= reader->start;
+      reader->start = 0;
+    }
+
+    if (reader->end == reader->size) {
+      if (reader->size == CR_LINE_READER_MAX) {
+	reader->overlong = TRUE;
+	return G_IO_STATUS_ERROR;
+      }
+      reader->size = MIN(reader->size * 2, CR_LINE_READER_MAX);
+      reader->buf = g_realloc(reader->buf, reader->size);
+    }
+
+    bytes_read = read(fd, reader->buf + reader->end,
+		      reader->size - reader->end);
+    if (bytes_read > 0) {
+      reader->end += bytes_read;
+    }
+    else if (bytes_read == 0) {
+      return G_IO_STATUS_EOF;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return G_IO_STATUS_AGAIN;
+    }
+    else if (errno != EINTR) {
+      return G_IO_STATUS_ERROR;
+    }
+  }
+}
+
+#define CRREADLINE_BUFFERED(pos, reader, fd, where)			\
+  while (1) {								\
+    GIOStatus __iostat;							\
+									\
+    __iostat = cr_line_reader_read_line(reader, fd, &(where));		\
+    if (__iostat == G_IO_STATUS_AGAIN) {				\
+      CRYIELD(pos);							\
+    }									\
+    else if (__iostat == G_IO_STATUS_NORMAL) {				\
+      break;								\
+    }									\
+    else {								\
+      CRHALT;								\
+    }									\
+  }
+
 G_END_DECLS
 
 #endif
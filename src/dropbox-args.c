@@ -0,0 +1,309 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-args.c
+ * A small container for the arguments of a Dropbox command or hook.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "dropbox-client-util.h"
+#include "dropbox-args.h"
+
+/*
+  Messages only carry a couple of args, so instead of a hash table of
+  separately allocated strings we keep a flat array of (key atom, values)
+  pairs.  The value vectors and their strings are packed into one arena
+  that starts out inside the struct, so a typical message costs a single
+  allocation.  Big messages (lots of paths) spill the arena to the heap.
+
+  Escapes in parsed lines are only decoded, in place, the first time
+  their key is looked up, so args nobody asks for never get decoded.
+  That makes lookups writes too: like adding, they mustn't race each
+  other, which holds as long as args are only handed across threads
+  with a queue or g_idle_add.
+*/
+
+#define DROPBOX_ARGS_INLINE_SIZE 512
+
+typedef struct {
+  GQuark key;
+  gchar **vals;     /* NULL terminated, points into the arena */
+  gboolean escaped; /* vals still need decoding */
+} DropboxArg;
+
+struct _DropboxArgs {
+  gint ref_count;
+  guint n_args;
+  DropboxArg args[DROPBOX_ARGS_MAX];
+  gchar *arena;
+  gsize arena_used;
+  gsize arena_size;
+  /* gpointer so the value vectors stored here are aligned */
+  gpointer inline_arena[DROPBOX_ARGS_INLINE_SIZE / sizeof(gpointer)];
+};
+
+DropboxArgs *
+dropbox_args_new(void) {
+  DropboxArgs *args = g_new(DropboxArgs, 1);
+
+  args->ref_count = 1;
+  args->n_args = 0;
+  args->arena = (gchar *) args->inline_arena;
+  args->arena_used = 0;
+  args->arena_size = sizeof(args->inline_arena);
+
+  return args;
+}
+
+/* thread safe */
+DropboxArgs *
+dropbox_args_ref(DropboxArgs *args) {
+  g_atomic_int_inc(&(args->ref_count));
+  return args;
+}
+
+/* thread safe */
+void
+dropbox_args_unref(DropboxArgs *args) {
+  if (g_atomic_int_dec_and_test(&(args->ref_count))) {
+    if (args->arena != (gchar *) args->inline_arena) {
+      g_free(args->arena);
+    }
+    g_free(args);
+  }
+}
+
+/*
+  Makes room for len more bytes in the arena, moving it to the heap if
+  needed.  Every pointer into the arena is fixed up after a move.
+*/
+static void
+arena_reserve(DropboxArgs *args, gsize len) {
+  gchar *old_arena = args->arena;
+  gsize new_size;
+  guint i;
+
+  if (args->arena_used + len <= args->arena_size) {
+    return;
+  }
+
+  new_size = args->arena_size * 2;
+  while (new_size < args->arena_used + len) {
+    new_size *= 2;
+  }
+
+  if (old_arena == (gchar *) args->inline_arena) {
+    args->arena = g_malloc(new_size);
+    memcpy(args->arena, old_arena, args->arena_used);
+  }
+  else {
+    args->arena = g_realloc(old_arena, new_size);
+  }
+  args->arena_size = new_size;
+
+  if (args->arena != old_arena) {
+    for (i = 0; i < args->n_args; i++) {
+      gchar **vals;
+      int j;
+
+      vals = (gchar **) (args->arena + ((gchar *) args->args[i].vals - old_arena));
+      for (j = 0; vals[j] != NULL; j++) {
+	vals[j] = args->arena + (vals[j] - old_arena);
+      }
+      args->args[i].vals = vals;
+    }
+  }
+}
+
+/* carves out a vector of n_vals strings taking up len bytes in total */
+static gchar **
+arena_alloc_vals(DropboxArgs *args, guint n_vals, gsize len, gchar **strings) {
+  gsize vals_size, pad;
+  gchar **vals;
+
+  pad = (sizeof(gpointer) - args->arena_used % sizeof(gpointer)) % sizeof(gpointer);
+  vals_size = (n_vals + 1) * sizeof(gchar *);
+
+  arena_reserve(args, pad + vals_size + len);
+
+  vals = (gchar **) (args->arena + args->arena_used + pad);
+  vals[n_vals] = NULL;
+  *strings = (gchar *) vals + vals_size;
+  args->arena_used += pad + vals_size + len;
+
+  return vals;
+}
+
+static gboolean
+set_arg(DropboxArgs *args, GQuark key, gchar **vals, gboolean escaped) {
+  guint i;
+
+  /* later args win, like they did with the hash table */
+  for (i = 0; i < args->n_args; i++) {
+    if (args->args[i].key == key) {
+      args->args[i].vals = vals;
+      args->args[i].escaped = escaped;
+      return TRUE;
+    }
+  }
+
+  if (args->n_args == DROPBOX_ARGS_MAX) {
+    return FALSE;
+  }
+
+  args->args[args->n_args].key = key;
+  args->args[args->n_args].vals = vals;
+  args->args[args->n_args].escaped = escaped;
+  args->n_args++;
+
+  return TRUE;
+}
+
+/* adds key with n_vals values, or all of them if n_vals is -1 */
+gboolean
+dropbox_args_add(DropboxArgs *args, const gchar *key,
+		 const gchar * const *vals, gint n_vals) {
+  gchar **arena_vals;
+  gchar *strings;
+  gsize len = 0;
+  gint i;
+
+  if (args->n_args == DROPBOX_ARGS_MAX) {
+    return FALSE;
+  }
+
+  if (n_vals < 0) {
+    for (n_vals = 0; vals[n_vals] != NULL; n_vals++);
+  }
+
+  for (i = 0; i < n_vals; i++) {
+    len += strlen(vals[i]) + 1;
+  }
+
+  arena_vals = arena_alloc_vals(args, n_vals, len, &strings);
+  for (i = 0; i < n_vals; i++) {
+    gsize val_len = strlen(vals[i]) + 1;
+    memcpy(strings, vals[i], val_len);
+    arena_vals[i] = strings;
+    strings += val_len;
+  }
+
+  return set_arg(args, g_quark_from_string(key), arena_vals, FALSE);
+}
+
+gboolean
+dropbox_args_add_single(DropboxArgs *args, const gchar *key,
+			const gchar *val) {
+  const gchar *vals[2] = {val, NULL};
+  return dropbox_args_add(args, key, vals, 1);
+}
+
+/*
+  Parses one "key\tval\tval..." line off the wire and adds it.
+  Returns FALSE if the line is malformed.
+*/
+gboolean
+dropbox_args_parse_line(DropboxArgs *args, const gchar *line) {
+  gchar **fields, *strings;
+  gsize len;
+  guint n_fields;
+  gboolean escaped;
+  const gchar *p;
+
+  if (args->n_args == DROPBOX_ARGS_MAX) {
+    return FALSE;
+  }
+
+  len = strlen(line);
+  for (n_fields = 1, p = line; (p = memchr(p, '\t', line + len - p)) != NULL; p++) {
+    n_fields++;
+  }
+
+  if (n_fields <= 1) {
+    return FALSE;
+  }
+
+  /* the fields sit right after each other once the line is split, so
+     the key is in fields[0] and the values follow */
+  fields = arena_alloc_vals(args, n_fields, len + 1, &strings);
+  memcpy(strings, line, len + 1);
+  dropbox_client_util_command_split_arg(strings, fields, n_fields);
+
+  /* the key is needed right away, the values can wait for a lookup */
+  escaped = memchr(line, '\\', len) != NULL;
+  if (escaped && strchr(fields[0], '\\') != NULL) {
+    dropbox_client_util_desanitize_in_place(fields[0]);
+  }
+
+  return set_arg(args, g_quark_from_string(fields[0]), fields + 1, escaped);
+}
+
+static gchar **
+arg_vals(DropboxArg *arg) {
+  if (arg->escaped) {
+    int i;
+
+    for (i = 0; arg->vals[i] != NULL; i++) {
+      if (strchr(arg->vals[i], '\\') != NULL) {
+	dropbox_client_util_desanitize_in_place(arg->vals[i]);
+      }
+    }
+    arg->escaped = FALSE;
+  }
+
+  return arg->vals;
+}
+
+/* returns the NULL terminated values for key, owned by args */
+gchar **
+dropbox_args_lookup(DropboxArgs *args, const gchar *key) {
+  GQuark quark;
+  guint i;
+
+  /* a key nobody has ever used can't be in here */
+  quark = g_quark_try_string(key);
+  if (quark == 0) {
+    return NULL;
+  }
+
+  for (i = 0; i < args->n_args; i++) {
+    if (args->args[i].key == quark) {
+      return arg_vals(&(args->args[i]));
+    }
+  }
+
+  return NULL;
+}
+
+guint
+dropbox_args_size(DropboxArgs *args) {
+  return args->n_args;
+}
+
+/* returns the nth key and stores its values in vals */
+const gchar *
+dropbox_args_nth(DropboxArgs *args, guint n, gchar ***vals) {
+  g_assert(n < args->n_args);
+
+  *vals = arg_vals(&(args->args[n]));
+  return g_quark_to_string(args->args[n].key);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-args.h
+ * Header file for dropbox-args.c
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_ARGS_H
+#define DROPBOX_ARGS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* the protocol never sends more than this many args in one message */
+#define DROPBOX_ARGS_MAX 20
+
+typedef struct _DropboxArgs DropboxArgs;
+
+DropboxArgs *dropbox_args_new(void);
+DropboxArgs *dropbox_args_ref(DropboxArgs *args);
+void dropbox_args_unref(DropboxArgs *args);
+
+gboolean dropbox_args_add(DropboxArgs *args, const gchar *key,
+			  const gchar * const *vals, gint n_vals);
+gboolean dropbox_args_add_single(DropboxArgs *args, const gchar *key,
+				 const gchar *val);
+gboolean dropbox_args_parse_line(DropboxArgs *args, const gchar *line);
+
+gchar **dropbox_args_lookup(DropboxArgs *args, const gchar *key);
+
+guint dropbox_args_size(DropboxArgs *args);
+const gchar *dropbox_args_nth(DropboxArgs *args, guint n, gchar ***vals);
+
+G_END_DECLS
+
+#endif
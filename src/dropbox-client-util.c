@@ -21,71 +21,196 @@
  *
  */
 
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <glib.h>
 
-static gchar chars_not_to_escape[] = {
-  1, 2, 3, 4, 5, 6, 7, 8, 11, 12,
-  13, 14, 15, 16, 17, 18, 19, 20, 21, 22,
-  23, 24, 25, 26, 27, 28, 29, 30, 31, 34, 127,
-  -128, -127, -126, -125, -124, -123, -122, -121, -120, -119,
-  -118, -117, -116, -115, -114, -113, -112, -111, -110, -109,
-  -108, -107, -106, -105, -104, -103, -102, -101, -100, -99,
-  -98, -97, -96, -95, -94, -93, -92, -91, -90, -89,
-  -88, -87, -86, -85, -84, -83, -82, -81, -80, -79,
-  -78, -77, -76, -75, -74, -73, -72, -71, -70, -69,
-  -68, -67, -66, -65, -64, -63, -62, -61, -60, -59,
-  -58, -57, -56, -55, -54, -53, -52, -51, -50, -49,
-  -48, -47, -46, -45, -44, -43, -42, -41, -40, -39,
-  -38, -37, -36, -35, -34, -33, -32, -31, -30, -29,
-  -28, -27, -26, -25, -24, -23, -22, -21, -20, -19,
-  -18, -17, -16, -15, -14, -13, -12, -11, -10, -9,
-  -8, -7, -6, -5, -4, -3, -2, -1, 0
-};
+#include "dropbox-client-util.h"
+
+/* the only bytes the protocol escapes are '\\', '\n' and '\t' */
+static inline gboolean
+is_special(gchar c) {
+  return c == '\\' || c == '\n' || c == '\t';
+}
+
+/* returns the offset of the first byte that needs escaping, or len */
+static gsize
+find_special_scalar(const gchar *a, gsize len) {
+  gsize i;
+
+  for (i = 0; i < len; i++) {
+    if (is_special(a[i])) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+#ifdef __SSE2__
+/* SSE2 is always there on x86_64, so there's nothing to pick at runtime */
+static gsize
+find_special(const gchar *a, gsize len) {
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i tab = _mm_set1_epi8('\t');
+  gsize i = 0;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *) (a + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, backslash),
+							   _mm_cmpeq_epi8(chunk, newline)),
+					      _mm_cmpeq_epi8(chunk, tab)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  return i + find_special_scalar(a + i, len - i);
+}
+#else
+#define find_special find_special_scalar
+#endif
+
+/*
+  Returns the escaped form of a, or a itself if nothing in it needs
+  escaping.  In the second case *allocated is set to NULL, otherwise it
+  points to the string to free.
+*/
+const gchar *
+dropbox_client_util_sanitize_borrowed(const gchar *a, gchar **allocated) {
+  gsize len, i, specials;
+  gchar *toret, *out;
+
+  len = strlen(a);
+  i = find_special(a, len);
+  if (i == len) {
+    *allocated = NULL;
+    return a;
+  }
+
+  /* count the rest so we only allocate once */
+  for (specials = 0; i < len; i += 1 + find_special(a + i + 1, len - i - 1)) {
+    specials++;
+  }
+
+  toret = out = g_new(gchar, len + specials + 1);
+  for (i = 0; i < len; i++) {
+    switch (a[i]) {
+    case '\\': *out++ = '\\'; *out++ = '\\'; break;
+    case '\n': *out++ = '\\'; *out++ = 'n'; break;
+    case '\t': *out++ = '\\'; *out++ = 't'; break;
+    default: *out++ = a[i]; break;
+    }
+  }
+  *out = '\0';
+
+  *allocated = toret;
+  return toret;
+}
 
 gchar *dropbox_client_util_sanitize(const gchar *a) {
   /* this function escapes teh following utf-8 characters:
    * '\\', '\n', '\t'
-   */
-  return g_strescape(a, chars_not_to_escape);
+   * which is what g_strescape() does when told to leave every other
+   * byte alone */
+  gchar *allocated;
+  const gchar *toret;
+
+  toret = dropbox_client_util_sanitize_borrowed(a, &allocated);
+  return allocated != NULL ? allocated : g_strdup(toret);
 }
 
 gchar *dropbox_client_util_desanitize(const gchar *a) {
-  return g_strcompress(a);
+  gchar *toret = g_strdup(a);
+
+  /* only escaped strings need decoding */
+  if (strchr(toret, '\\') != NULL) {
+    dropbox_client_util_desanitize_in_place(toret);
+  }
+
+  return toret;
 }
 
-gboolean
-dropbox_client_util_command_parse_arg(const gchar *line, GHashTable *return_table) {
-  gchar **argval;
-  guint len;
-  gboolean retval;
-  
-  argval = g_strsplit(line, "\t", 0);
-  len = g_strv_length(argval);
-
-  /*  debug("parsed: (%d) %s", len, line); */
-  
-  if (len > 1) {
-    int i;
-    gchar **vals;
-    
-    vals = g_new(gchar *, len);
-    vals[len - 1] = NULL;
-    
-    for (i = 1; argval[i] != NULL; i++) {
-      vals[i-1] = dropbox_client_util_desanitize(argval[i]);
-      
+/*
+  Decodes the escapes in a in place, the same way g_strcompress() does.
+  Decoding never makes a string longer so this is always safe.
+*/
+void
+dropbox_client_util_desanitize_in_place(gchar *a) {
+  const gchar *p = a;
+  gchar *q = a;
+
+  while (*p) {
+    if (*p == '\\') {
+      p++;
+      switch (*p) {
+      case '\0':
+	/* trailing backslash, g_strcompress drops it too */
+	goto out;
+      case '0': case '1': case '2': case '3':
+      case '4': case '5': case '6': case '7': {
+	const gchar *s = p;
+	*q = 0;
+	while ((p < s + 3) && (*p >= '0') && (*p <= '7')) {
+	  *q = (*q * 8) + (*p - '0');
+	  p++;
+	}
+	q++;
+	p--;
+      }
+	break;
+      case 'b': *q++ = '\b'; break;
+      case 'f': *q++ = '\f'; break;
+      case 'n': *q++ = '\n'; break;
+      case 'r': *q++ = '\r'; break;
+      case 't': *q++ = '\t'; break;
+      case 'v': *q++ = '\v'; break;
+      default: *q++ = *p; break;
+      }
+    }
+    else {
+      *q++ = *p;
     }
-    
-    g_hash_table_insert(return_table,
-			dropbox_client_util_desanitize(argval[0]),
-			vals);
-    retval = TRUE;
+    p++;
   }
-  else {
-    retval = FALSE;
+out:
+  *q = '\0';
+}
+
+/*
+  Splits an argument line at its tabs in place and stores a pointer to
+  each field in fields, the first one being the argument name.  Fields
+  are left escaped, run them through
+  dropbox_client_util_desanitize_in_place() before using them.
+
+  Returns the number of fields, or 0 if there were more than max_fields.
+*/
+guint
+dropbox_client_util_command_split_arg(gchar *line, gchar **fields,
+				      guint max_fields) {
+  guint n = 0;
+
+  while (1) {
+    gchar *tab;
+
+    if (n == max_fields) {
+      return 0;
+    }
+
+    fields[n++] = line;
+    tab = strchr(line, '\t');
+    if (tab == NULL) {
+      break;
+    }
+
+    *tab = '\0';
+    line = tab + 1;
   }
 
-  g_strfreev(argval);
-  return retval;
+  return n;
 }
-
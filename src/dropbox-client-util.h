@@ -30,9 +30,14 @@ G_BEGIN_DECLS
 
 gchar *dropbox_client_util_sanitize(const gchar *a);
 gchar *dropbox_client_util_desanitize(const gchar *a);
+const gchar *dropbox_client_util_sanitize_borrowed(const gchar *a,
+						   gchar **allocated);
 
-gboolean
-dropbox_client_util_command_parse_arg(const gchar *line, GHashTable *return_table);
+void dropbox_client_util_desanitize_in_place(gchar *a);
+
+guint
+dropbox_client_util_command_split_arg(gchar *line, gchar **fields,
+				      guint max_fields);
 
 G_END_DECLS
 
@@ -34,6 +34,7 @@
 #include <glib.h>
 
 #include "g-util.h"
+#include "dropbox-probes.h"
 #include "dropbox-client-util.h"
 #include "dropbox-command-client.h"
 #include "nautilus-dropbox.h"
@@ -61,7 +62,7 @@ typedef struct {
 
 typedef struct {
   DropboxGeneralCommand *dgc;
-  GHashTable *response;
+  DropboxArgs *response;
 } DropboxGeneralCommandResponse;
 
 static gboolean
@@ -92,7 +93,7 @@ on_connection_attempt(ConnectionAttempt *ca) {
 }
 
 static gboolean
-receive_args_until_done(GIOChannel *chan, GHashTable *return_table,
+receive_args_until_done(GIOChannel *chan, DropboxArgs *return_args,
 			GError **err) {
   GIOStatus iostat;
   GError *tmp_error = NULL;
@@ -103,7 +104,7 @@ receive_args_until_done(GIOChannel *chan, GHashTable *return_table,
     gsize term_pos;
 
     /* if we are getting too many args, connection could be malicious */
-    if (numargs >= 20) {
+    if (numargs >= DROPBOX_ARGS_MAX) {
       g_set_error(err,
 		  g_quark_from_static_string("malicious connection"),
 		  0, "malicious connection");
@@ -137,7 +138,7 @@ receive_args_until_done(GIOChannel *chan, GHashTable *return_table,
     else {
       gboolean parse_result;
 
-      parse_result = dropbox_client_util_command_parse_arg(line, return_table);
+      parse_result = dropbox_args_parse_line(return_args, line);
       g_free(line);
 
       if (FALSE == parse_result) {
@@ -154,30 +155,17 @@ receive_args_until_done(GIOChannel *chan, GHashTable *return_table,
   return TRUE;
 }
 
-static void my_g_hash_table_get_keys_helper(gpointer key,
-					    gpointer value,
-					    GList **ud) {
-  *ud = g_list_append(*ud, key);
-}
-
-static GList *my_g_hash_table_get_keys(GHashTable *ght) {
-  GList *list = NULL;
-  g_hash_table_foreach(ght, (GHFunc) 
-		       my_g_hash_table_get_keys_helper, &list);
-  return list;
-}
-
 /*
   sends a command to the dropbox server
-  returns an hash of the return values
+  returns the return values
 
   in theory, this should disconnection errors
   but it doesn't matter right now, any error is a sufficient
   condition to disconnect
 */
-static GHashTable *
+static DropboxArgs *
 send_command_to_db(GIOChannel *chan, const gchar *command_name,
-		   GHashTable *args, GError **err) {
+		   DropboxArgs *args, GError **err) {
   GError *tmp_error = NULL;
   GIOStatus iostat;
   gsize bytes_trans;
@@ -188,11 +176,12 @@ send_command_to_db(GIOChannel *chan, const gchar *command_name,
   
 
 #define WRITE_OR_DIE_SANI(s,l) {					\
-    gchar *sani_s;							\
-    sani_s = dropbox_client_util_sanitize(s);				\
+    const gchar *sani_s;						\
+    gchar *sani_alloc;							\
+    sani_s = dropbox_client_util_sanitize_borrowed(s, &sani_alloc);	\
     iostat = g_io_channel_write_chars(chan, sani_s,l, &bytes_trans,	\
 				      &tmp_error);			\
-    g_free(sani_s);							\
+    g_free(sani_alloc);							\
     if (iostat == G_IO_STATUS_ERROR ||					\
 	iostat == G_IO_STATUS_AGAIN) {					\
       if (tmp_error != NULL) {						\
@@ -219,28 +208,20 @@ send_command_to_db(GIOChannel *chan, const gchar *command_name,
   WRITE_OR_DIE("\n", -1);
 
   if (args != NULL) {
-    GList *keys, *li;
+    guint n;
 
-    /* oh god */
-    keys = glib_check_version(2, 14, 0)
-      ? my_g_hash_table_get_keys(args)
-      : g_hash_table_get_keys(args);
-
-    for (li = keys; li != NULL; li = g_list_next(li)) {
+    for (n = 0; n < dropbox_args_size(args); n++) {
       int i;
       gchar **value;
       
-      WRITE_OR_DIE_SANI((gchar *) li->data, -1);
+      WRITE_OR_DIE_SANI(dropbox_args_nth(args, n, &value), -1);
       
-      value = g_hash_table_lookup(args, li->data);
       for (i = 0; value[i] != NULL; i++) {
 	WRITE_OR_DIE("\t", -1);
 	WRITE_OR_DIE_SANI(value[i], -1);
       }
       WRITE_OR_DIE("\n", -1);
     }
-
-    g_list_free(keys);
   }
 
   WRITE_OR_DIE("done\n", -1);
@@ -253,6 +234,7 @@ send_command_to_db(GIOChannel *chan, const gchar *command_name,
     g_propagate_error(err, tmp_error);
     return NULL;
   }
+  ND_PROBE1(command_write, command_name);
 
   /* now we have to read the data */
   iostat = g_io_channel_read_line(chan, &line, NULL,
@@ -281,23 +263,20 @@ send_command_to_db(GIOChannel *chan, const gchar *command_name,
 
   /* if the response was okay */
   if (strncmp(line, "ok\n", 3) == 0) {
-    GHashTable *return_table = 
-      g_hash_table_new_full((GHashFunc) g_str_hash,
-			    (GEqualFunc) g_str_equal,
-			    (GDestroyNotify) g_free,
-			    (GDestroyNotify) g_strfreev);
+    DropboxArgs *return_args = dropbox_args_new();
     
     g_free(line);
     line = NULL;
 
-    receive_args_until_done(chan, return_table, &tmp_error);
+    receive_args_until_done(chan, return_args, &tmp_error);
     if (tmp_error != NULL) {
-      g_hash_table_destroy(return_table);
+      dropbox_args_unref(return_args);
       g_propagate_error(err, tmp_error);
       return NULL;
     }
-      
-    return return_table;
+
+    ND_PROBE2(command_read, command_name, 1);
+    return return_args;
   }
   /* otherwise */
   else {
@@ -335,6 +314,7 @@ send_command_to_db(GIOChannel *chan, const gchar *command_name,
       /* we got our line */
     } while (strncmp(line, "done\n", 5) != 0);
 
+    ND_PROBE2(command_read, command_name, 0);
     g_free(line);
     return NULL;
   }
@@ -346,85 +326,50 @@ do_file_info_command(GIOChannel *chan, DropboxFileInfoCommand *dfic, GError **ge
      file status, and folder_tags */
   GError *tmp_gerr = NULL;
   DropboxFileInfoCommandResponse *dficr;
-  GHashTable *file_status_response = NULL, *args, *folder_tag_response = NULL, *emblems_response = NULL;
-  gchar *filename = NULL;
-
-  {
-    gchar *filename_un, *uri;
-    uri = nautilus_file_info_get_uri(dfic->file);
-    filename_un = uri ? g_filename_from_uri(uri, NULL, NULL): NULL;
-    g_free(uri);
-    if (filename_un) {
-      filename = g_filename_to_utf8(filename_un, -1, NULL, NULL, NULL);
-      g_free(filename_un);
-      if (filename == NULL) {
-        /* oooh, filename wasn't correctly encoded. mark as  */
-	debug("file wasn't correctly encoded %s", filename_un);
-      }
-    }
-  }
+  DropboxArgs *file_status_response = NULL, *args, *folder_tag_response = NULL, *emblems_response = NULL;
+  /* resolved on the main loop, NautilusFileInfo isn't ours to touch here */
+  const gchar *filename = dfic->filename;
 
   if (filename == NULL) {
     /* We couldn't get the filename.  Just return empty. */
     goto exit;
   }
 
-  args = g_hash_table_new_full((GHashFunc) g_str_hash,
-			       (GEqualFunc) g_str_equal,
-			       (GDestroyNotify) g_free,
-			       (GDestroyNotify) g_strfreev);
-  {
-    gchar **path_arg;
-    path_arg = g_new(gchar *, 2);
-    path_arg[0] = g_strdup(filename);
-    path_arg[1] = NULL;
-    g_hash_table_insert(args, g_strdup("path"), path_arg);
-  }
+  args = dropbox_args_new();
+  dropbox_args_add_single(args, "path", filename);
 
   emblems_response = send_command_to_db(chan, "get_emblems", args, NULL);
   if (emblems_response) {
       /* Don't need to do the other calls. */
-      g_hash_table_unref(args);
+      dropbox_args_unref(args);
       goto exit;
   }
 
   /* send status command to server */
   file_status_response = send_command_to_db(chan, "icon_overlay_file_status",
 					    args, &tmp_gerr);
-  g_hash_table_unref(args);
-  args = NULL;
+
   if (tmp_gerr != NULL) {
-    g_free(filename);
+    dropbox_args_unref(args);
     g_assert(file_status_response == NULL);
     g_propagate_error(gerr, tmp_gerr);
     return;
   }
 
-  if (nautilus_file_info_is_directory(dfic->file)) {
-    args = g_hash_table_new_full((GHashFunc) g_str_hash,
-				 (GEqualFunc) g_str_equal,
-				 (GDestroyNotify) g_free,
-				 (GDestroyNotify) g_strfreev);
-    {
-      gchar **paths_arg;
-      paths_arg = g_new(gchar *, 2);
-      paths_arg[0] = g_strdup(filename);
-      paths_arg[1] = NULL;
-      g_hash_table_insert(args, g_strdup("path"), paths_arg);
-    }
-    
+  /* get_folder_tag takes the same path arg */
+  if (dfic->is_directory) {
     folder_tag_response =
       send_command_to_db(chan, "get_folder_tag", args, &tmp_gerr);
-    g_hash_table_unref(args);
-    args = NULL;
     if (tmp_gerr != NULL) {
+      dropbox_args_unref(args);
       if (file_status_response != NULL)
-	g_hash_table_destroy(file_status_response);
+	dropbox_args_unref(file_status_response);
       g_assert(folder_tag_response == NULL);
       g_propagate_error(gerr, tmp_gerr);
       return;
     }
   }
+  dropbox_args_unref(args);
   
   /* great server responded perfectly,
      now let's get this request done,
@@ -435,10 +380,9 @@ exit:
   dficr->folder_tag_response = folder_tag_response;
   dficr->file_status_response = file_status_response;
   dficr->emblems_response = emblems_response;
+  ND_PROBE1(idle_handoff, dfic);
   g_idle_add((GSourceFunc) nautilus_dropbox_finish_file_info_command, dficr);
 
-  g_free(filename);
-  
   return;
 }
 
@@ -449,12 +393,12 @@ finish_general_command(DropboxGeneralCommandResponse *dgcr) {
   }
   
   if (dgcr->response != NULL) {
-    g_hash_table_unref(dgcr->response);
+    dropbox_args_unref(dgcr->response);
   }
 
   g_free(dgcr->dgc->command_name);
   if (dgcr->dgc->command_args != NULL) {
-    g_hash_table_unref(dgcr->dgc->command_args);
+    dropbox_args_unref(dgcr->dgc->command_args);
   }
   g_free(dgcr->dgc);
   g_free(dgcr);
@@ -466,7 +410,7 @@ static void
 do_general_command(GIOChannel *chan, DropboxGeneralCommand *dcac,
 		   GError **gerr) {
   GError *tmp_gerr = NULL;
-  GHashTable *response;
+  DropboxArgs *response;
 
   /* send status command to server */
   response = send_command_to_db(chan, dcac->command_name,
@@ -553,9 +497,10 @@ end_request(DropboxCommand *dc) {
 
 static gpointer
 dropbox_command_client_thread(DropboxCommandClient *dcc) {
-  struct sockaddr_un addr;
-  socklen_t addr_len;
+  struct sockaddr_un addr, broker_addr;
+  socklen_t addr_len, broker_addr_len;
   int connection_attempts = 1;
+  gboolean try_broker = TRUE;
 
   /* intialize address structure */
   addr.sun_family = AF_UNIX;
@@ -565,11 +510,23 @@ dropbox_command_client_thread(DropboxCommandClient *dcc) {
 	     g_get_home_dir());
   addr_len = sizeof(addr) - sizeof(addr.sun_path) + strlen(addr.sun_path);
 
+  /* "dropbox broker" shares one daemon connection between clients,
+     go through it whenever it's running */
+  broker_addr.sun_family = AF_UNIX;
+  g_snprintf(broker_addr.sun_path,
+	     sizeof(broker_addr.sun_path),
+	     "%s/.dropbox/command_broker_socket",
+	     g_get_home_dir());
+  broker_addr_len = sizeof(broker_addr) - sizeof(broker_addr.sun_path) +
+    strlen(broker_addr.sun_path);
+
   while (1) {
     GIOChannel *chan = NULL;
     GError *gerr = NULL;
     int sock;
     gboolean failflag = TRUE;
+    struct sockaddr_un *target = try_broker ? &broker_addr : &addr;
+    socklen_t target_len = try_broker ? broker_addr_len : addr_len;
 
     do {
       int flags;
@@ -602,7 +559,7 @@ dropbox_command_client_thread(DropboxCommandClient *dcc) {
       }
 
       /* if there was an error we have to try again later */
-      if (connect(sock, (struct sockaddr *) &addr, addr_len) < 0) {
+      if (connect(sock, (struct sockaddr *) target, target_len) < 0) {
 	if (errno == EINPROGRESS) {
 	  fd_set writers;
 	  struct timeval tv = {1, 0};
@@ -616,7 +573,7 @@ dropbox_command_client_thread(DropboxCommandClient *dcc) {
 	    break;
 	  }
 
-	  if (connect(sock, (struct sockaddr *) &addr, addr_len) < 0) {
+	  if (connect(sock, (struct sockaddr *) target, target_len) < 0) {
 	    /*	    debug("couldn't connect to command server after 1 second"); */
 	    break;
 	  }
@@ -637,7 +594,15 @@ dropbox_command_client_thread(DropboxCommandClient *dcc) {
       failflag = FALSE;
     } while (0);
 
-    if (failflag) {
+    if (failflag && try_broker) {
+      /* no broker, straight on to the daemon */
+      if (sock >= 0) {
+	close(sock);
+      }
+      try_broker = FALSE;
+      continue;
+    }
+    else if (failflag) {
       ConnectionAttempt *ca = g_new(ConnectionAttempt, 1);
       ca->dcc = dcc;
       ca->connect_attempt = connection_attempts;
@@ -647,10 +612,13 @@ dropbox_command_client_thread(DropboxCommandClient *dcc) {
       }
       g_usleep(G_USEC_PER_SEC);
       connection_attempts++;
+      try_broker = TRUE;
       continue;
     }
     else {
       connection_attempts = 0;
+      /* after a disconnect, look for a broker again */
+      try_broker = TRUE;
     }
 
     /* connected */
@@ -681,6 +649,7 @@ dropbox_command_client_thread(DropboxCommandClient *dcc) {
 	/* get a request from nautilus */
 	dc = g_async_queue_timed_pop(dcc->command_queue, &gtv);
 	if (dc != NULL) {
+	  ND_PROBE1(request_dequeue, dc);
 	  break;
 	}
 	else {
@@ -769,6 +738,7 @@ void dropbox_command_client_force_reconnect(DropboxCommandClient *dcc) {
 /* thread safe */
 void
 dropbox_command_client_request(DropboxCommandClient *dcc, DropboxCommand *dc) {
+  ND_PROBE1(request_enqueue, dc);
   g_async_queue_push(dcc->command_queue, dc);
 }
 
@@ -865,10 +835,7 @@ void dropbox_command_client_send_command(DropboxCommandClient *dcc,
   dgc = g_new(DropboxGeneralCommand, 1);
   dgc->dc.request_type = GENERAL_COMMAND;
   dgc->command_name = g_strdup(command);
-  dgc->command_args = g_hash_table_new_full((GHashFunc) g_str_hash,
-					    (GEqualFunc) g_str_equal,
-					    (GDestroyNotify) g_free,
-					    (GDestroyNotify) g_strfreev);
+  dgc->command_args = dropbox_args_new();
   /*
    * NB: The handler is called in the DropboxCommandClient Thread.  If you need
    * it in the main thread you must call g_idle_add in the callback.
@@ -877,15 +844,7 @@ void dropbox_command_client_send_command(DropboxCommandClient *dcc,
   dgc->handler_ud = ud;
 
   while ((na = va_arg(ap, char *)) != NULL) {
-    gchar **is_active_arg;
-
-    is_active_arg = g_new(gchar *, 2);
-
-    g_hash_table_insert(dgc->command_args,
-			g_strdup(na), is_active_arg);
-
-    is_active_arg[0] = g_strdup(va_arg(ap, char *));
-    is_active_arg[1] = NULL;
+    dropbox_args_add_single(dgc->command_args, na, va_arg(ap, char *));
   }
   va_end(ap);
 
@@ -27,6 +27,8 @@
 #include <libnautilus-extension/nautilus-info-provider.h>
 #include <libnautilus-extension/nautilus-file-info.h>
 
+#include "dropbox-args.h"
+
 G_BEGIN_DECLS
 
 /* command structs */
@@ -36,27 +38,31 @@ typedef struct {
   NautilusDropboxRequestType request_type;
 } DropboxCommand;
 
+/* the command thread only reads filename and is_directory, the rest
+   belongs to the main loop */
 typedef struct {
   DropboxCommand dc;
   NautilusInfoProvider *provider;
   GClosure *update_complete;
   NautilusFileInfo *file;
+  gchar *filename;
+  gboolean is_directory;
   gboolean cancelled;
 } DropboxFileInfoCommand;
 
 typedef struct {
   DropboxFileInfoCommand *dfic;
-  GHashTable *file_status_response;
-  GHashTable *folder_tag_response;
-  GHashTable *emblems_response;
+  DropboxArgs *file_status_response;
+  DropboxArgs *folder_tag_response;
+  DropboxArgs *emblems_response;
 } DropboxFileInfoCommandResponse;
 
-typedef void (*NautilusDropboxCommandResponseHandler)(GHashTable *, gpointer);
+typedef void (*NautilusDropboxCommandResponseHandler)(DropboxArgs *, gpointer);
 
 typedef struct {
   DropboxCommand dc;
   gchar *command_name;
-  GHashTable *command_args;
+  DropboxArgs *command_args;
   NautilusDropboxCommandResponseHandler handler;
   gpointer handler_ud;
 } DropboxGeneralCommand;
@@ -0,0 +1,511 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-log.c
+ * Runtime ring buffer for debug() messages.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "dropbox-log.h"
+
+/*
+  debug() used to be compiled out of release builds and be a handful of
+  synchronous g_print calls in debug builds.  Now every thread that logs
+  gets its own ring of fixed size records, so recording a message is a
+  clock read and a copy of the format pointer and the arguments into
+  memory only that thread writes to: no locks, no allocation, no IO and
+  no formatting.  When logging is off it's a single branch.
+
+  The arguments are kept as they were passed, except that %s strings are
+  copied into the record since most of them are freed right afterwards.
+  Formatting happens when the rings are dumped.  A format with more
+  arguments than a record holds, or a conversion we don't know, is
+  formatted on the spot instead.
+
+  Set NAUTILUS_DROPBOX_LOG=1 to turn it on at startup.  We don't install
+  any signal handlers in nautilus; instead the main loop checks the
+  control file (~/.cache/nautilus-dropbox/log-control) once a second.
+  Writing "on" or "off" to it switches logging at runtime, "dump" writes
+  the rings to NAUTILUS_DROPBOX_LOG_FILE, or log-<pid> next to the
+  control file.  If NAUTILUS_DROPBOX_LOG_FILE is set the rings are also
+  written there when nautilus exits.  Records being written while we
+  dump may come out garbled.
+*/
+
+#define LOG_RING_SIZE 512 /* records per thread, must be a power of 2 */
+#define LOG_MAX_ARGS 6
+#define LOG_STR_SIZE 96   /* copies of %s arguments, or the whole message */
+#define LOG_LINE_SIZE 256 /* longest line a dump writes */
+
+typedef union {
+  gint64 i;
+  gdouble d;
+  gconstpointer p;
+  gsize str;        /* offset of the copy in strs */
+} LogArg;
+
+typedef struct {
+  gint64 usec;
+  const gchar *func;
+  const gchar *format; /* NULL if strs holds the formatted message */
+  LogArg args[LOG_MAX_ARGS];
+  gchar strs[LOG_STR_SIZE];
+} LogRecord;
+
+typedef struct _LogRing LogRing;
+struct _LogRing {
+  LogRing *next;
+  guint id;
+  volatile guint head; /* total records ever written */
+  LogRecord records[LOG_RING_SIZE];
+};
+
+volatile gint dropbox_log_enabled = 0;
+
+static LogRing * volatile rings = NULL;
+static volatile gint n_rings = 0;
+static __thread LogRing *my_ring = NULL;
+
+static LogRing *
+new_ring(void) {
+  LogRing *ring = g_new0(LogRing, 1);
+
+#if GLIB_CHECK_VERSION(2, 30, 0)
+  ring->id = g_atomic_int_add(&n_rings, 1);
+#else
+  ring->id = g_atomic_int_exchange_and_add(&n_rings, 1);
+#endif
+
+  /* push onto the list, rings are never freed so this is all the
+     dumper needs */
+  do {
+    ring->next = rings;
+  } while (!g_atomic_pointer_compare_and_exchange((gpointer *) &rings,
+						  ring->next, ring));
+
+  return ring;
+}
+
+/* one printf conversion: where it is in the format and what it takes */
+typedef struct {
+  const gchar *start;  /* the '%' */
+  gsize len;           /* up to and including the conversion character */
+  guint stars;         /* '*' widths and precisions, each takes an int */
+  gchar length;        /* 0, 'h' (h and hh), 'l', 'q' (ll), 'z', 'j' or 't' */
+  gchar conversion;
+} LogSpec;
+
+/* parses the conversion starting at the '%' at p, FALSE for ones we
+   don't handle */
+static gboolean
+parse_spec(const gchar *p, LogSpec *spec) {
+  spec->start = p++;
+  spec->stars = 0;
+  spec->length = 0;
+
+  while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+    p++;
+  for (; *p == '*' || g_ascii_isdigit(*p) || *p == '.'; p++) {
+    if (*p == '*')
+      spec->stars++;
+  }
+  switch (*p) {
+  case 'h':
+    spec->length = 'h';
+    p += p[1] == 'h' ? 2 : 1;
+    break;
+  case 'l':
+    spec->length = p[1] == 'l' ? 'q' : 'l';
+    p += p[1] == 'l' ? 2 : 1;
+    break;
+  case 'z': case 'j': case 't':
+    spec->length = *p++;
+    break;
+  }
+
+  spec->conversion = *p;
+  spec->len = p + 1 - spec->start;
+  return *p != '\0' && strchr("diouxXcpseEfgGaA%", *p) != NULL &&
+    (spec->length == 0 || strchr("diouxX", *p) != NULL);
+}
+
+static gint64
+take_int(LogSpec *spec, va_list *args) {
+  gboolean is_signed = spec->conversion == 'd' || spec->conversion == 'i';
+
+  switch (spec->length) {
+  case 'l':
+    return is_signed ? va_arg(*args, long) : (gint64) va_arg(*args, unsigned long);
+  case 'q':
+    return is_signed ? va_arg(*args, long long) : (gint64) va_arg(*args, unsigned long long);
+  case 'z':
+    return (gint64) va_arg(*args, size_t);
+  case 'j':
+    return (gint64) va_arg(*args, intmax_t);
+  case 't':
+    return (gint64) va_arg(*args, ptrdiff_t);
+  default:
+    return is_signed ? va_arg(*args, int) : (gint64) va_arg(*args, unsigned int);
+  }
+}
+
+/* copies the arguments of format into rec, FALSE if they don't fit */
+static gboolean
+capture_args(LogRecord *rec, const gchar *format, va_list *args) {
+  const gchar *p;
+  gsize used = 0;
+  guint n = 0, i;
+  LogSpec spec;
+
+  for (p = strchr(format, '%'); p != NULL; p = strchr(p + spec.len, '%')) {
+    if (!parse_spec(p, &spec))
+      return FALSE;
+    if (spec.conversion == '%')
+      continue;
+    if (n + spec.stars + 1 > LOG_MAX_ARGS)
+      return FALSE;
+
+    for (i = 0; i < spec.stars; i++) {
+      rec->args[n++].i = va_arg(*args, int);
+    }
+
+    switch (spec.conversion) {
+    case 's': {
+      const gchar *str = va_arg(*args, const gchar *);
+      gsize len;
+
+      if (str == NULL)
+	str = "(null)";
+      len = MIN(strlen(str), sizeof(rec->strs) - 1 - used);
+      memcpy(rec->strs + used, str, len);
+      rec->strs[used + len] = '\0';
+      rec->args[n++].str = used;
+      used = MIN(used + len + 1, sizeof(rec->strs) - 1);
+      break;
+    }
+    case 'p':
+      rec->args[n++].p = va_arg(*args, gconstpointer);
+      break;
+    case 'e': case 'E': case 'f': case 'g': case 'G': case 'a': case 'A':
+      rec->args[n++].d = va_arg(*args, gdouble);
+      break;
+    default:
+      rec->args[n++].i = take_int(&spec, args);
+      break;
+    }
+  }
+
+  return TRUE;
+}
+
+void
+dropbox_log(const gchar *func, const gchar *format, ...) {
+  LogRing *ring = my_ring;
+  LogRecord *rec;
+  struct timespec ts;
+  va_list args, copy;
+
+  if (G_UNLIKELY(ring == NULL)) {
+    ring = my_ring = new_ring();
+  }
+
+  rec = &(ring->records[ring->head & (LOG_RING_SIZE - 1)]);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  rec->usec = (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+  rec->func = func;
+
+  va_start(args, format);
+  G_VA_COPY(copy, args);
+  if (capture_args(rec, format, &copy)) {
+    rec->format = format;
+  }
+  else {
+    rec->format = NULL;
+    g_vsnprintf(rec->strs, sizeof(rec->strs), format, args);
+  }
+  va_end(copy);
+  va_end(args);
+
+  /* publish the record */
+  g_atomic_int_inc((gint *) &(ring->head));
+}
+
+/* formats rec's message into buf the way vsnprintf would have */
+static gsize
+format_record(LogRecord *rec, gchar *buf, gsize size) {
+  const gchar *p = rec->format, *next;
+  gsize out = 0;
+  guint n = 0;
+  LogSpec spec;
+
+  if (p == NULL) {
+    g_strlcpy(buf, rec->strs, size);
+    return strlen(buf);
+  }
+
+  for (; out < size - 1 && *p != '\0'; p = next) {
+    gchar one[32], *q = one;
+    gsize len;
+    guint i;
+
+    if (*p != '%' || !parse_spec(p, &spec)) {
+      next = strchr(p + 1, '%');
+      if (next == NULL)
+	next = p + strlen(p);
+      len = MIN((gsize) (next - p), size - 1 - out);
+      memcpy(buf + out, p, len);
+      out += len;
+      continue;
+    }
+    next = p + spec.len;
+
+    /* the conversion on its own, the '*'s replaced by what they took */
+    for (i = 0; i < spec.len && q < one + sizeof(one) - 12; i++) {
+      if (spec.start[i] == '*')
+	q += g_snprintf(q, 12, "%d", (int) rec->args[n++].i);
+      else
+	*q++ = spec.start[i];
+    }
+    *q = '\0';
+
+    switch (spec.conversion) {
+    case '%':
+      len = g_snprintf(buf + out, size - out, "%%");
+      break;
+    case 's':
+      len = g_snprintf(buf + out, size - out, one, rec->strs + rec->args[n++].str);
+      break;
+    case 'p':
+      len = g_snprintf(buf + out, size - out, one, rec->args[n++].p);
+      break;
+    case 'e': case 'E': case 'f': case 'g': case 'G': case 'a': case 'A':
+      len = g_snprintf(buf + out, size - out, one, rec->args[n++].d);
+      break;
+    default:
+      if (spec.length == 0 || spec.length == 'h') {
+	len = g_snprintf(buf + out, size - out, one, (int) rec->args[n++].i);
+      }
+      else {
+	/* anything wider than an int was kept as a gint64 */
+	gchar *mod = one + strlen(one) - 1;
+
+	while (strchr("hlzjt", mod[-1]) != NULL)
+	  mod--;
+	g_snprintf(mod, sizeof(one) - (mod - one), "ll%c", spec.conversion);
+	len = g_snprintf(buf + out, size - out, one, (long long) rec->args[n++].i);
+      }
+      break;
+    }
+    out = MIN(out + len, size - 1);
+  }
+
+  buf[out] = '\0';
+  return out;
+}
+
+static void
+write_record(int fd, LogRing *ring, LogRecord *rec) {
+  gchar line[LOG_LINE_SIZE];
+  gsize len;
+
+  len = g_snprintf(line, sizeof(line), "%" G_GINT64_FORMAT ".%06d [%u] %s: ",
+		   rec->usec / G_USEC_PER_SEC, (int) (rec->usec % G_USEC_PER_SEC),
+		   ring->id, rec->func);
+  len = MIN(len, sizeof(line) - 2);
+  len += format_record(rec, line + len, sizeof(line) - 1 - len);
+  line[len++] = '\n';
+
+  /* nothing sensible to do if the file is gone */
+  if (write(fd, line, len) < 0) {
+    return;
+  }
+}
+
+/* writes every thread's ring to fd, oldest record first */
+void
+dropbox_log_dump(int fd) {
+  LogRing *ring;
+
+  for (ring = rings; ring != NULL; ring = ring->next) {
+    guint head = ring->head, i;
+    guint start = head > LOG_RING_SIZE ? head - LOG_RING_SIZE : 0;
+
+    for (i = start; i != head; i++) {
+      write_record(fd, ring, &(ring->records[i & (LOG_RING_SIZE - 1)]));
+    }
+  }
+}
+
+static gchar *
+log_dir(void) {
+  return g_build_filename(g_get_user_cache_dir(), "nautilus-dropbox", NULL);
+}
+
+static void
+dump_to_file(void) {
+  const gchar *env = g_getenv("NAUTILUS_DROPBOX_LOG_FILE");
+  gchar *filename;
+  int fd;
+
+  if (env != NULL && env[0] != '\0') {
+    filename = g_strdup(env);
+  }
+  else {
+    gchar *dirname = log_dir(), *basename;
+
+    g_mkdir_with_parents(dirname, 0700);
+    basename = g_strdup_printf("log-%d", (int) getpid());
+    filename = g_build_filename(dirname, basename, NULL);
+    g_free(basename);
+    g_free(dirname);
+  }
+
+  fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if (fd >= 0) {
+    dropbox_log_dump(fd);
+    close(fd);
+  }
+  else {
+    g_printerr("nautilus-dropbox: couldn't write log to %s: %s\n",
+	       filename, g_strerror(errno));
+  }
+
+  g_free(filename);
+}
+
+static void
+dump_at_exit(void) {
+  if (rings != NULL)
+    dump_to_file();
+}
+
+static gchar *control_file = NULL;
+
+/* everything that changes when the control file is written, down to
+   the nanosecond, so two writes within a second aren't taken for one.
+   The size and ctime catch writes that keep the mtime, like a restored
+   backup or touch -r */
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  struct timespec ctime;
+} ControlStamp;
+
+static ControlStamp control_stamp;
+
+/* reads the control file if it changed since last time, returns its
+   first word or NULL */
+static gchar *
+read_control(void) {
+  struct stat st;
+  ControlStamp stamp;
+  gchar *contents = NULL;
+
+  if (stat(control_file, &st) < 0)
+    return NULL;
+
+  memset(&stamp, 0, sizeof(stamp));
+  stamp.dev = st.st_dev;
+  stamp.ino = st.st_ino;
+  stamp.size = st.st_size;
+  stamp.mtime = st.st_mtim;
+  stamp.ctime = st.st_ctim;
+  if (memcmp(&stamp, &control_stamp, sizeof(stamp)) == 0)
+    return NULL;
+  control_stamp = stamp;
+
+  if (!g_file_get_contents(control_file, &contents, NULL, NULL))
+    return NULL;
+
+  return g_strstrip(contents);
+}
+
+static void
+apply_control(const gchar *command) {
+  if (strcmp(command, "on") == 0) {
+    g_atomic_int_set(&dropbox_log_enabled, 1);
+  }
+  else if (strcmp(command, "off") == 0) {
+    g_atomic_int_set(&dropbox_log_enabled, 0);
+  }
+  else if (strcmp(command, "dump") == 0) {
+    dump_to_file();
+  }
+}
+
+static gboolean
+poll_control(gpointer data) {
+  gchar *command = read_control();
+
+  if (command != NULL) {
+    apply_control(command);
+    g_free(command);
+  }
+
+  return TRUE;
+}
+
+/* call once at module load, before the main loop runs */
+void
+dropbox_log_init(void) {
+  const gchar *env = g_getenv("NAUTILUS_DROPBOX_LOG");
+  gchar *dirname;
+
+#ifdef ND_DEBUG
+  if (env == NULL) {
+    env = "1";
+  }
+#endif
+
+  if (env != NULL && strcmp(env, "0") != 0) {
+    g_atomic_int_set(&dropbox_log_enabled, 1);
+  }
+
+  env = g_getenv("NAUTILUS_DROPBOX_LOG_FILE");
+  if (env != NULL && env[0] != '\0') {
+    atexit(dump_at_exit);
+  }
+
+  dirname = log_dir();
+  control_file = g_build_filename(dirname, "log-control", NULL);
+  g_free(dirname);
+
+  /* whatever a control file left over from an earlier session says is
+     stale, only act on it once it's written again */
+  g_free(read_control());
+
+  g_timeout_add_seconds(1, poll_control, NULL);
+}
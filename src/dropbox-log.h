@@ -0,0 +1,41 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-log.h
+ * Header file for dropbox-log.c
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_LOG_H
+#define DROPBOX_LOG_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* set from NAUTILUS_DROPBOX_LOG at startup and switched through the
+   control file, checked before every record */
+extern volatile gint dropbox_log_enabled;
+
+void dropbox_log_init(void);
+void dropbox_log(const gchar *func, const gchar *format, ...) G_GNUC_PRINTF(2, 3);
+void dropbox_log_dump(int fd);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-probes.h
+ * Static tracepoints.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_PROBES_H
+#define DROPBOX_PROBES_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+/*
+  Static tracepoints on the request lifecycle, under the "nautilus_dropbox"
+  provider.  With sys/sdt.h each one is a single nop plus a note in the
+  ELF, so they stay in release builds; attach with e.g.
+
+    perf probe -x libnautilus-dropbox.so sdt_nautilus_dropbox:request_enqueue
+    bpftrace -e 'usdt:libnautilus-dropbox.so:nautilus_dropbox:* { ... }'
+
+  Without sys/sdt.h they compile to nothing.
+*/
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define ND_PROBE1(name, a) DTRACE_PROBE1(nautilus_dropbox, name, a)
+#define ND_PROBE2(name, a, b) DTRACE_PROBE2(nautilus_dropbox, name, a, b)
+
+#else
+
+#define ND_PROBE1(name, a) do {} while(0)
+#define ND_PROBE2(name, a, b) do {} while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-tsan.h
+ * ThreadSanitizer annotations for GLib handoffs.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DROPBOX_TSAN_H
+#define DROPBOX_TSAN_H
+
+/*
+  TSan only sees the synchronization it intercepts, and a GLib that
+  wasn't built with -fsanitize=thread locks with bare futexes.  So every
+  request handed to the command thread through its GAsyncQueue, every
+  response handed back with g_idle_add and everything under a GMutex
+  would look like a race.  In --enable-tsan builds the calls we hand
+  memory across threads with are routed through wrappers that tell TSan
+  about the happens-before edge; otherwise this header does nothing.
+*/
+
+#if defined(__SANITIZE_THREAD__)
+#define ND_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define ND_TSAN 1
+#endif
+#endif
+
+#ifdef ND_TSAN
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void __tsan_acquire(void *addr);
+void __tsan_release(void *addr);
+
+static inline void
+nd_tsan_mutex_lock(GMutex *mutex) {
+  g_mutex_lock(mutex);
+  __tsan_acquire(mutex);
+}
+
+static inline void
+nd_tsan_mutex_unlock(GMutex *mutex) {
+  __tsan_release(mutex);
+  g_mutex_unlock(mutex);
+}
+
+/* the queue stands in for every item in it */
+static inline void
+nd_tsan_async_queue_push(GAsyncQueue *queue, gpointer data) {
+  __tsan_release(queue);
+  g_async_queue_push(queue, data);
+}
+
+static inline gpointer
+nd_tsan_async_queue_timed_pop(GAsyncQueue *queue, GTimeVal *end_time) {
+  gpointer data = g_async_queue_timed_pop(queue, end_time);
+  __tsan_acquire(queue);
+  return data;
+}
+
+static inline gpointer
+nd_tsan_async_queue_try_pop(GAsyncQueue *queue) {
+  gpointer data = g_async_queue_try_pop(queue);
+  __tsan_acquire(queue);
+  return data;
+}
+
+typedef struct {
+  GSourceFunc function;
+  gpointer data;
+} NdTsanIdle;
+
+static inline gboolean
+nd_tsan_idle_dispatch(gpointer data) {
+  NdTsanIdle *idle = data;
+
+  __tsan_acquire(idle);
+  return idle->function(idle->data);
+}
+
+static inline guint
+nd_tsan_idle_add(GSourceFunc function, gpointer data) {
+  NdTsanIdle *idle = g_new(NdTsanIdle, 1);
+
+  idle->function = function;
+  idle->data = data;
+  __tsan_release(idle);
+  return g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, nd_tsan_idle_dispatch,
+			 idle, g_free);
+}
+
+#undef g_mutex_lock
+#undef g_mutex_unlock
+#define g_mutex_lock nd_tsan_mutex_lock
+#define g_mutex_unlock nd_tsan_mutex_unlock
+#define g_async_queue_push nd_tsan_async_queue_push
+#define g_async_queue_timed_pop nd_tsan_async_queue_timed_pop
+#define g_async_queue_try_pop nd_tsan_async_queue_try_pop
+#define g_idle_add nd_tsan_idle_add
+
+G_END_DECLS
+
+#endif
+
+#endif
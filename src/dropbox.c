@@ -31,6 +31,7 @@
 #include <gtk/gtk.h>
 
 #include "nautilus-dropbox.h"
+#include "dropbox-log.h"
 
 static GType type_list[1];
 
@@ -38,6 +39,8 @@ void
 nautilus_module_initialize (GTypeModule *module) {
   g_print ("Initializing %s\n", PACKAGE_STRING);
 
+  dropbox_log_init();
+
   nautilus_dropbox_register_type (module);
   type_list[0] = NAUTILUS_TYPE_DROPBOX;
 
@@ -27,22 +27,21 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 
-G_BEGIN_DECLS
-
-#ifdef ND_DEBUG
-
-#define debug_enter() {g_print("Entering "); g_print(__FUNCTION__); g_printf("\n");}
-#define debug(format, ...) {g_print(__FUNCTION__); g_print(": "); \
-    g_printf(format, ## __VA_ARGS__); g_print("\n");}
-#define debug_return(v) {g_print("Exiting "); g_print(__FUNCTION__); g_printf("\n"); return v;}
+#include "dropbox-log.h"
+#include "dropbox-tsan.h"
 
-#else
-
-#define debug_enter() do {} while(0)
-#define debug(format, ...) do {} while(0)
-#define debug_return(v) do {} while(0)
+G_BEGIN_DECLS
 
-#endif
+/* these go to the per-thread log rings in dropbox-log.c, which cost one
+   branch while logging is off, see dropbox-log.c for switching it on.
+   The arguments are only evaluated when it's on, but they are then, so
+   don't pass anything that needs freeing. */
+#define debug_enter() debug("entering")
+#define debug(format, ...) do {						\
+    if (G_UNLIKELY(dropbox_log_enabled))				\
+      dropbox_log(__FUNCTION__, format, ## __VA_ARGS__);		\
+  } while (0)
+#define debug_return(v) debug("exiting")
 
 G_END_DECLS
 
@@ -33,6 +33,7 @@
 #include <glib.h>
 
 #include "g-util.h"
+#include "dropbox-probes.h"
 #include "async-io-coroutine.h"
 #include "dropbox-client-util.h"
 #include "nautilus-dropbox-hooks.h"
@@ -55,68 +56,74 @@ handle_hook_server_input(GIOChannel *chan,
      async event handler like a microthread yeahh, watch out for context */
   CRBEGIN(hookserv->hhsi.line);
   while (1) {
-    hookserv->hhsi.command_args =
-      g_hash_table_new_full((GHashFunc) g_str_hash,
-			    (GEqualFunc) g_str_equal,
-			    (GDestroyNotify) g_free,
-			    (GDestroyNotify) g_strfreev);
+    hookserv->hhsi.hook_data = NULL;
+    hookserv->hhsi.command_args = NULL;
     hookserv->hhsi.numargs = 0;
     
-    /* read the command name */
+    /* read the command name, we only need to decode it if it has
+       escapes.  The line goes away with the next read, so keep a copy
+       of the name around for the probe */
     {
       gchar *line;
-      CRREADLINE(hookserv->hhsi.line, chan, line);
-      hookserv->hhsi.command_name = dropbox_client_util_desanitize(line);
-      g_free(line);
+      CRREADLINE_BUFFERED(hookserv->hhsi.line, &(hookserv->hhsi.reader),
+			  hookserv->socket, line);
+      if (strchr(line, '\\') != NULL) {
+	dropbox_client_util_desanitize_in_place(line);
+      }
+      hookserv->hhsi.hook_data =
+	g_hash_table_lookup(hookserv->dispatch_table, line);
+      g_strlcpy(hookserv->hhsi.command_name, line,
+		sizeof(hookserv->hhsi.command_name));
     }
 
-    /*debug("got a hook name: %s", hookserv->hhsi.command_name); */
+    /* nobody is listening for this hook, don't bother parsing its args */
+    if (hookserv->hhsi.hook_data != NULL) {
+      hookserv->hhsi.command_args = dropbox_args_new();
+    }
 
     /* now read each arg line (until a certain limit) until we receive "done" */
     while (1) {
       gchar *line;
 
       /* if too many arguments, this connection seems malicious */
-      if (hookserv->hhsi.numargs >= 20) {
+      if (hookserv->hhsi.numargs >= DROPBOX_ARGS_MAX) {
 	CRHALT;
       }
 
-      CRREADLINE(hookserv->hhsi.line, chan, line);
+      CRREADLINE_BUFFERED(hookserv->hhsi.line, &(hookserv->hhsi.reader),
+			  hookserv->socket, line);
 
       if (strcmp("done", line) == 0) {
-	g_free(line);
 	break;
       }
-      else {
+      else if (hookserv->hhsi.command_args != NULL) {
 	gboolean parse_result;
 	
 	parse_result =
-	  dropbox_client_util_command_parse_arg(line,
-						hookserv->hhsi.command_args);
-	g_free(line);
+	  dropbox_args_parse_line(hookserv->hhsi.command_args, line);
 
 	if (FALSE == parse_result) {
 	  debug("bad parse");
 	  CRHALT;
 	}
       }
+      else if (strchr(line, '\t') == NULL) {
+	debug("bad parse");
+	CRHALT;
+      }
 
       hookserv->hhsi.numargs += 1;
     }
 
-    {
-      HookData *hd;
-      hd = (HookData *)
-	g_hash_table_lookup(hookserv->dispatch_table,
-			    hookserv->hhsi.command_name);
-      if (hd != NULL) {
-	(hd->hook)(hookserv->hhsi.command_args, hd->ud);
-      }
+    ND_PROBE2(hook_receive, hookserv->hhsi.command_name, hookserv->hhsi.numargs);
+
+    if (hookserv->hhsi.hook_data != NULL) {
+      HookData *hd = (HookData *) hookserv->hhsi.hook_data;
+      (hd->hook)(hookserv->hhsi.command_args, hd->ud);
+      dropbox_args_unref(hookserv->hhsi.command_args);
     }
     
-    g_free(hookserv->hhsi.command_name);
-    g_hash_table_unref(hookserv->hhsi.command_args);
-    hookserv->hhsi.command_name = NULL;
+    hookserv->hhsi.hook_data = NULL;
     hookserv->hhsi.command_args = NULL;
   }
   CREND;
@@ -128,17 +135,18 @@ watch_killer(NautilusDropboxHookserv *hookserv) {
 
   hookserv->connected = FALSE;
 
+  if (hookserv->hhsi.reader.overlong) {
+    debug("hook line longer than %d bytes, reconnecting", CR_LINE_READER_MAX);
+  }
+
   g_hook_list_invoke(&(hookserv->ondisconnect_hooklist), FALSE);
   
   /* we basically just have to free the memory allocated in the
      handle_hook_server_init ctx */
-  if (hookserv->hhsi.command_name != NULL) {
-    g_free(hookserv->hhsi.command_name);
-    hookserv->hhsi.command_name = NULL;
-  }
+  hookserv->hhsi.hook_data = NULL;
 
   if (hookserv->hhsi.command_args != NULL) {
-    g_hash_table_unref(hookserv->hhsi.command_args);
+    dropbox_args_unref(hookserv->hhsi.command_args);
     hookserv->hhsi.command_args = NULL;
   }
 
@@ -241,7 +249,8 @@ try_to_connect(NautilusDropboxHookserv *hookserv) {
   /* this is fun, async io watcher */
   hookserv->hhsi.line = 0;
   hookserv->hhsi.command_args = NULL;
-  hookserv->hhsi.command_name = NULL;
+  hookserv->hhsi.hook_data = NULL;
+  cr_line_reader_reset(&(hookserv->hhsi.reader));
   hookserv->event_source = 
     g_io_add_watch_full(hookserv->chan, G_PRIORITY_DEFAULT,
 			G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
@@ -290,6 +299,7 @@ nautilus_dropbox_hooks_setup(NautilusDropboxHookserv *hookserv) {
 						   (GEqualFunc) g_str_equal,
 						   g_free, g_free);
   hookserv->connected = FALSE;
+  cr_line_reader_init(&(hookserv->hhsi.reader));
 
   g_hook_list_init(&(hookserv->ondisconnect_hooklist), sizeof(GHook));
   g_hook_list_init(&(hookserv->onconnect_hooklist), sizeof(GHook));
@@ -26,9 +26,12 @@
 
 #include <glib.h>
 
+#include "async-io-coroutine.h"
+#include "dropbox-args.h"
+
 G_BEGIN_DECLS
 
-typedef void (*DropboxUpdateHook)(GHashTable *, gpointer);
+typedef void (*DropboxUpdateHook)(DropboxArgs *, gpointer);
 typedef void (*DropboxHookClientConnectHook)(gpointer);
 
 typedef struct {
@@ -36,8 +39,10 @@ typedef struct {
   int socket;
   struct {
     int line;
-    gchar *command_name;
-    GHashTable *command_args;
+    CRLineReader reader;
+    gchar command_name[64]; /* truncated, only for the hook_receive probe */
+    gpointer hook_data;
+    DropboxArgs *command_args;
     int numargs;
   } hhsi;
   gboolean connected;
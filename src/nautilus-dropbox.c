@@ -31,6 +31,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -42,6 +44,7 @@
 #include <libnautilus-extension/nautilus-info-provider.h>
 
 #include "g-util.h"
+#include "dropbox-probes.h"
 #include "dropbox-command-client.h"
 #include "nautilus-dropbox.h"
 #include "nautilus-dropbox-hooks.h"
@@ -120,6 +123,7 @@ exit:
 static void
 reset_file(NautilusFileInfo *file) {
   debug("resetting file %p", (void *) file);
+  ND_PROBE1(reset_file, file);
   nautilus_file_info_invalidate_extension_info(file);
 }
 
@@ -133,6 +137,104 @@ reset_all_files(NautilusDropbox *cvs) {
   return FALSE;
 }
 
+/*
+  Reads NAUTILUS_DROPBOX_MAX_FILES, 0 (no limit) if it's unset or not a
+  positive number.  Values past what a guint holds are clamped.
+*/
+static guint
+max_tracked_files_from_env(void) {
+  const gchar *max_files = g_getenv("NAUTILUS_DROPBOX_MAX_FILES");
+  gchar *end = NULL;
+  guint64 value = 0;
+
+  if (max_files == NULL)
+    return 0;
+
+  /* g_ascii_strtoull takes "-1" and negates it, so insist on a digit */
+  if (g_ascii_isdigit(*max_files)) {
+    errno = 0;
+    value = g_ascii_strtoull(max_files, &end, 10);
+  }
+  if (end == NULL || *end != '\0' || value == 0) {
+    debug("ignoring NAUTILUS_DROPBOX_MAX_FILES=%s, not a positive number",
+	  max_files);
+    return 0;
+  }
+
+  if (errno == ERANGE || value > G_MAXUINT) {
+    debug("NAUTILUS_DROPBOX_MAX_FILES=%s is too big, using %u",
+	  max_files, G_MAXUINT);
+    return G_MAXUINT;
+  }
+
+  return (guint) value;
+}
+
+/*
+  With NAUTILUS_DROPBOX_MAX_FILES set, only that many files stay in
+  filename2obj/obj2filename.  The ones nautilus asked about least recently
+  are dropped, and simply miss shell_touch until nautilus asks about them
+  again.
+*/
+static void
+lru_touch(NautilusDropbox *cvs, NautilusFileInfo *file) {
+  GList *link;
+
+  if (cvs->max_tracked_files == 0)
+    return;
+
+  if ((link = g_hash_table_lookup(cvs->obj2lru, file)) != NULL) {
+    g_queue_unlink(cvs->tracked_lru, link);
+    g_queue_push_head_link(cvs->tracked_lru, link);
+  }
+  else {
+    g_queue_push_head(cvs->tracked_lru, file);
+    g_hash_table_insert(cvs->obj2lru, file, cvs->tracked_lru->head);
+  }
+}
+
+static void
+lru_forget(NautilusDropbox *cvs, NautilusFileInfo *file) {
+  GList *link;
+
+  if (cvs->max_tracked_files == 0)
+    return;
+
+  if ((link = g_hash_table_lookup(cvs->obj2lru, file)) != NULL) {
+    g_queue_delete_link(cvs->tracked_lru, link);
+    g_hash_table_remove(cvs->obj2lru, file);
+  }
+}
+
+static void
+sum_tracked_file(NautilusFileInfo *file, gchar *filename, gsize *bytes) {
+  *bytes += strlen(filename) + 1;
+}
+
+static void
+tracked_files_report(NautilusDropbox *cvs) {
+  gsize bytes = 0, overhead;
+
+  /* both tables keep their own copy of each path */
+  g_hash_table_foreach(cvs->obj2filename, (GHFunc) sum_tracked_file, &bytes);
+  bytes *= 2;
+
+  /* a rough guess at the hash nodes (and lru links), glib doesn't say */
+  overhead = (g_hash_table_size(cvs->filename2obj) +
+	      g_hash_table_size(cvs->obj2filename)) * 4 * sizeof(gpointer);
+  if (cvs->max_tracked_files > 0) {
+    overhead += g_hash_table_size(cvs->obj2lru) * 4 * sizeof(gpointer) +
+      g_queue_get_length(cvs->tracked_lru) * sizeof(GList);
+  }
+
+  debug("tracking %u files (%u paths, %u pushed emblems), "
+	"%" G_GSIZE_FORMAT " bytes of paths + ~%" G_GSIZE_FORMAT " bytes of tables, "
+	"%" G_GUINT64_FORMAT " evicted (limit %u)",
+	g_hash_table_size(cvs->obj2filename),
+	g_hash_table_size(cvs->filename2obj),
+	g_hash_table_size(cvs->pushed_emblems),
+	bytes, overhead, cvs->evicted_files, cvs->max_tracked_files);
+}
 
 static void
 when_file_dies(NautilusDropbox *cvs, NautilusFileInfo *address) {
@@ -148,8 +250,10 @@ when_file_dies(NautilusDropbox *cvs, NautilusFileInfo *address) {
   /* too chatty */
   /*  debug("removing %s <-> 0x%p", filename, address); */
 
+  g_hash_table_remove(cvs->pushed_emblems, filename);
   g_hash_table_remove(cvs->filename2obj, filename);
   g_hash_table_remove(cvs->obj2filename, address);
+  lru_forget(cvs, address);
 }
 
 static void
@@ -181,8 +285,10 @@ changed_cb(NautilusFileInfo *file, NautilusDropbox *cvs) {
   if (filename == NULL) {
       /* A file has moved to offline storage. Lets remove it from our tables. */
       g_object_weak_unref(G_OBJECT(file), (GWeakNotify) when_file_dies, cvs);
+      g_hash_table_remove(cvs->pushed_emblems, filename2);
       g_hash_table_remove(cvs->filename2obj, filename2);
       g_hash_table_remove(cvs->obj2filename, file);
+      lru_forget(cvs, file);
       g_signal_handlers_disconnect_by_func(file, G_CALLBACK(changed_cb), cvs);
       reset_file(file);
       return;
@@ -194,6 +300,7 @@ changed_cb(NautilusFileInfo *file, NautilusDropbox *cvs) {
     debug("shifty old: %s, new %s", filename2, filename);
 
     /* gotta do this first, the call after this frees filename2 */
+    g_hash_table_remove(cvs->pushed_emblems, filename2);
     g_hash_table_remove(cvs->filename2obj, filename2);
 
     g_hash_table_replace(cvs->obj2filename, file, g_strdup(filename));
@@ -206,6 +313,7 @@ changed_cb(NautilusFileInfo *file, NautilusDropbox *cvs) {
 	/* lets fix it if it's true, just remove the mapping */
 	g_hash_table_remove(cvs->filename2obj, filename);
 	g_hash_table_remove(cvs->obj2filename, f2);
+	lru_forget(cvs, f2);
       }
     }
 
@@ -216,12 +324,78 @@ changed_cb(NautilusFileInfo *file, NautilusDropbox *cvs) {
   g_free(filename);
 }
 
+static void
+evict_tracked_files(NautilusDropbox *cvs) {
+  /* Only run this on the main loop or you'll cause problems. */
+  while (g_queue_get_length(cvs->tracked_lru) > cvs->max_tracked_files) {
+    NautilusFileInfo *file = g_queue_peek_tail(cvs->tracked_lru);
+    gchar *filename = g_hash_table_lookup(cvs->obj2filename, file);
+
+    g_object_weak_unref(G_OBJECT(file), (GWeakNotify) when_file_dies, cvs);
+    g_signal_handlers_disconnect_by_func(file, G_CALLBACK(changed_cb), cvs);
+    if (filename != NULL) {
+      g_hash_table_remove(cvs->pushed_emblems, filename);
+      g_hash_table_remove(cvs->filename2obj, filename);
+      g_hash_table_remove(cvs->obj2filename, file);
+    }
+    lru_forget(cvs, file);
+    cvs->evicted_files++;
+  }
+}
+
+static void
+add_emblems(NautilusFileInfo *file, gchar **emblem_list) {
+  int i;
+  for (i = 0; emblem_list[i] != NULL; i++) {
+    if (emblem_list[i][0])
+      nautilus_file_info_add_emblem(file, emblem_list[i]);
+  }
+}
+
+static gboolean
+under_root_paths(gchar **root_paths, const gchar *filename) {
+  int i;
+
+  for (i = 0; root_paths[i] != NULL; i++) {
+    gsize len = strlen(root_paths[i]);
+
+    if (strncmp(filename, root_paths[i], len) == 0 &&
+	(filename[len] == '\0' || filename[len] == '/' ||
+	 root_paths[i][len - 1] == '/')) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/*
+  Checks whether a canonicalized path lives under one of the Dropbox
+  folders the daemon told us about.  Until we know the folders every
+  path is considered to be in Dropbox.
+
+  This runs on the main thread for every file nautilus shows, so it only
+  compares strings and never touches the disk.  The Dropbox folder may be
+  a symlink and the daemon may report either end of it, so
+  get_root_paths_cb, on the command thread, keeps both the reported and
+  the resolved form of each folder.  Paths that only reach Dropbox
+  through some other symlink are treated as outside of it.
+*/
+static gboolean
+is_in_dropbox(NautilusDropbox *cvs, const gchar *filename) {
+  return cvs->root_paths == NULL ||
+    under_root_paths(cvs->root_paths, filename);
+}
+
 static NautilusOperationResult
 nautilus_dropbox_update_file_info(NautilusInfoProvider     *provider,
                                   NautilusFileInfo         *file,
                                   GClosure                 *update_complete,
                                   NautilusOperationHandle **handle) {
   NautilusDropbox *cvs;
+  gboolean in_dropbox;
+  gchar **pushed_emblems;
+  gchar *canonical_filename = NULL;
 
   cvs = NAUTILUS_DROPBOX(provider);
 
@@ -258,8 +432,9 @@ nautilus_dropbox_update_file_info(NautilusInfoProvider     *provider,
 	  /* this happens when the filename changes name on a file obj 
 	     but changed_cb isn't called */
 	  g_object_weak_unref(G_OBJECT(file), (GWeakNotify) when_file_dies, cvs);
-	  g_hash_table_remove(cvs->obj2filename, file);
+	  g_hash_table_remove(cvs->pushed_emblems, stored_filename);
 	  g_hash_table_remove(cvs->filename2obj, stored_filename);
+	  g_hash_table_remove(cvs->obj2filename, file);
 	  g_signal_handlers_disconnect_by_func(file, G_CALLBACK(changed_cb), cvs);
 	}
 	else if (stored_filename == NULL) {
@@ -278,6 +453,7 @@ nautilus_dropbox_update_file_info(NautilusInfoProvider     *provider,
 	    g_signal_handlers_disconnect_by_func(f2, G_CALLBACK(changed_cb), cvs);
 	    g_hash_table_remove(cvs->filename2obj, filename);
 	    g_hash_table_remove(cvs->obj2filename, f2);
+	    lru_forget(cvs, f2);
 	  }
 	}
 
@@ -289,12 +465,36 @@ nautilus_dropbox_update_file_info(NautilusInfoProvider     *provider,
 	g_signal_connect(file, "changed", G_CALLBACK(changed_cb), cvs);
       }
 
-      g_free(filename);
+      lru_touch(cvs, file);
+      if (cvs->max_tracked_files > 0 &&
+	  g_queue_get_length(cvs->tracked_lru) > cvs->max_tracked_files) {
+	evict_tracked_files(cvs);
+      }
+
+      in_dropbox = is_in_dropbox(cvs, filename);
+      pushed_emblems = g_hash_table_lookup(cvs->pushed_emblems, filename);
+      canonical_filename = filename;
     }
   }
 
   if (dropbox_client_is_connected(&(cvs->dc)) == FALSE ||
       nautilus_file_info_is_gone(file)) {
+    g_free(canonical_filename);
+    return NAUTILUS_OPERATION_COMPLETE;
+  }
+
+  /* the daemon won't know anything about files outside of dropbox,
+     don't bother asking */
+  if (!in_dropbox) {
+    cvs->rejected_lookups++;
+    g_free(canonical_filename);
+    return NAUTILUS_OPERATION_COMPLETE;
+  }
+
+  /* the daemon already told us the emblems over the hook socket */
+  if (pushed_emblems != NULL) {
+    add_emblems(file, pushed_emblems);
+    g_free(canonical_filename);
     return NAUTILUS_OPERATION_COMPLETE;
   }
 
@@ -306,6 +506,10 @@ nautilus_dropbox_update_file_info(NautilusInfoProvider     *provider,
     dfic->dc.request_type = GET_FILE_INFO;
     dfic->update_complete = g_closure_ref(update_complete);
     dfic->file = g_object_ref(file);
+    /* the command thread can't call into the NautilusFileInfo */
+    dfic->filename = g_filename_to_utf8(canonical_filename, -1, NULL, NULL, NULL);
+    dfic->is_directory = nautilus_file_info_is_directory(file);
+    g_free(canonical_filename);
     
     dropbox_command_client_request(&(cvs->dc.dcc), (DropboxCommand *) dfic);
     
@@ -317,32 +521,110 @@ nautilus_dropbox_update_file_info(NautilusInfoProvider     *provider,
   }
 }
 
+/* flush right away if a burst gets this big */
+#define MAX_PENDING_TOUCHES 4096
+
+static void
+flush_shell_touch(gchar *path, gpointer value, NautilusDropbox *cvs) {
+  NautilusFileInfo *file;
+  gchar *filename;
+
+  filename = canonicalize_path(path);
+  if (filename != NULL) {
+    debug("shell touch for %s", filename);
+
+    file = g_hash_table_lookup(cvs->filename2obj, filename);
+
+    if (file != NULL) {
+      debug("gonna reset %s", filename);
+      reset_file(file);
+    }
+    g_free(filename);
+  }
+}
+
+static gboolean
+flush_shell_touches(NautilusDropbox *cvs) {
+  /* Only run this on the main loop or you'll cause problems. */
+  g_hash_table_foreach(cvs->pending_touches, (GHFunc) flush_shell_touch, cvs);
+  g_hash_table_remove_all(cvs->pending_touches);
+  cvs->touch_flush_source = 0;
+  return FALSE;
+}
+
 static void
-handle_shell_touch(GHashTable *args, NautilusDropbox *cvs) {
+handle_shell_touch(DropboxArgs *args, NautilusDropbox *cvs) {
   gchar **path;
 
   //  debug_enter();
 
-  if ((path = g_hash_table_lookup(args, "path")) != NULL &&
-      path[0][0] == '/') {
-    NautilusFileInfo *file;
+  /* the daemon sends these in bursts while syncing, so we just remember
+     the path here and invalidate each file once after the burst.  idle
+     sources run after the hook socket watch so they won't fire until
+     there's nothing left to read */
+  if ((path = dropbox_args_lookup(args, "path")) != NULL &&
+      path[0] != NULL && path[0][0] == '/') {
+    /* whatever the daemon pushed for this file is stale now */
+    if (g_hash_table_size(cvs->pushed_emblems) > 0) {
+      gchar *filename = canonicalize_path(path[0]);
+      if (filename != NULL) {
+	g_hash_table_remove(cvs->pushed_emblems, filename);
+	g_free(filename);
+      }
+    }
+
+    g_hash_table_replace(cvs->pending_touches, g_strdup(path[0]), NULL);
+
+    /* don't let a never ending stream starve the idle flush */
+    if (g_hash_table_size(cvs->pending_touches) >= MAX_PENDING_TOUCHES) {
+      if (cvs->touch_flush_source != 0) {
+	g_source_remove(cvs->touch_flush_source);
+      }
+      flush_shell_touches(cvs);
+    }
+    else if (cvs->touch_flush_source == 0) {
+      cvs->touch_flush_source =
+	g_idle_add((GSourceFunc) flush_shell_touches, cvs);
+    }
+  }
+
+  return;
+}
+
+static void
+handle_shell_emblems(DropboxArgs *args, NautilusDropbox *cvs) {
+  gchar **path, **emblem_list;
+
+  /* like shell_touch, but the daemon sends the new emblems along so
+     we can answer nautilus without asking the daemon again */
+  if ((path = dropbox_args_lookup(args, "path")) != NULL &&
+      path[0] != NULL && path[0][0] == '/' &&
+      (emblem_list = dropbox_args_lookup(args, "emblems")) != NULL) {
     gchar *filename;
 
     filename = canonicalize_path(path[0]);
-    if (filename != NULL) {
-      debug("shell touch for %s", filename);
+    if (filename == NULL) {
+      return;
+    }
 
-      file = g_hash_table_lookup(cvs->filename2obj, filename);
+    /* only remember this for files nautilus is showing, it'll ask
+       about the others when it gets to them */
+    if (g_hash_table_lookup(cvs->filename2obj, filename) != NULL) {
+      debug("shell emblems for %s", filename);
 
-      if (file != NULL) {
-        debug("gonna reset %s", filename);
-        reset_file(file);
+      g_hash_table_replace(cvs->pushed_emblems, filename,
+			   g_strdupv(emblem_list));
+      g_hash_table_replace(cvs->pending_touches, g_strdup(path[0]), NULL);
+
+      if (cvs->touch_flush_source == 0) {
+	cvs->touch_flush_source =
+	  g_idle_add((GSourceFunc) flush_shell_touches, cvs);
       }
+    }
+    else {
       g_free(filename);
     }
   }
-
-  return;
 }
 
 gboolean
@@ -359,25 +641,21 @@ nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandResponse *dficr)
 
     /* if we have emblems just use them. */
     if (dficr->emblems_response != NULL &&
-	(status = g_hash_table_lookup(dficr->emblems_response, "emblems")) != NULL) {
-      int i;
-      for ( i = 0; status[i] != NULL; i++) {
-	  if (status[i][0])
-	    nautilus_file_info_add_emblem(dficr->dfic->file, status[i]);
-      }
+	(status = dropbox_args_lookup(dficr->emblems_response, "emblems")) != NULL) {
+      add_emblems(dficr->dfic->file, status);
       result = NAUTILUS_OPERATION_COMPLETE;
     }
     /* if the file status command went okay */
     else if ((dficr->file_status_response != NULL &&
 	(status =
-	 g_hash_table_lookup(dficr->file_status_response, "status")) != NULL) &&
+	 dropbox_args_lookup(dficr->file_status_response, "status")) != NULL) &&
 	((isdir == TRUE &&
 	  dficr->folder_tag_response != NULL) || isdir == FALSE)) {
       gchar **tag = NULL;
 
       /* set the tag emblem */
       if (isdir &&
-	  (tag = g_hash_table_lookup(dficr->folder_tag_response, "tag")) != NULL) {
+	  (tag = dropbox_args_lookup(dficr->folder_tag_response, "tag")) != NULL) {
 	if (strcmp("public", tag[0]) == 0) {
 	  nautilus_file_info_add_emblem(dficr->dfic->file, "web");
 	}
@@ -407,11 +685,14 @@ nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandResponse *dficr)
 	}
 
 	if (emblem_code > 0) {
-	  /*
-	    debug("%s to %s", emblems[emblem_code-1],
-	    g_filename_from_uri(nautilus_file_info_get_uri(dficr->dfic->file),
-	    NULL, NULL));
-	  */
+	  if (G_UNLIKELY(dropbox_log_enabled)) {
+	    gchar *uri = nautilus_file_info_get_uri(dficr->dfic->file);
+	    gchar *filename = g_filename_from_uri(uri, NULL, NULL);
+
+	    debug("%s to %s", emblems[emblem_code-1], filename);
+	    g_free(filename);
+	    g_free(uri);
+	  }
 	  nautilus_file_info_add_emblem(dficr->dfic->file, emblems[emblem_code-1]);
 	}
       }
@@ -419,6 +700,8 @@ nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandResponse *dficr)
     }
   }
 
+  ND_PROBE2(file_info_complete, dficr->dfic, result);
+
   /* complete the info request */
   if (!dropbox_use_operation_in_progress_workaround) {
       nautilus_info_provider_update_complete_invoke(dficr->dfic->update_complete,
@@ -429,17 +712,18 @@ nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandResponse *dficr)
 
   /* destroy the objects we created */
   if (dficr->file_status_response != NULL)
-    g_hash_table_unref(dficr->file_status_response);
+    dropbox_args_unref(dficr->file_status_response);
   if (dficr->folder_tag_response != NULL)
-    g_hash_table_unref(dficr->folder_tag_response);
+    dropbox_args_unref(dficr->folder_tag_response);
   if (dficr->emblems_response != NULL)
-    g_hash_table_unref(dficr->emblems_response);
+    dropbox_args_unref(dficr->emblems_response);
 
   /* unref the objects we didn't create */
   g_closure_unref(dficr->dfic->update_complete);
   g_object_unref(dficr->dfic->file);
 
   /* now free the structs */
+  g_free(dficr->dfic->filename);
   g_free(dficr->dfic);
   g_free(dficr);
 
@@ -472,10 +756,7 @@ menu_item_cb(NautilusMenuItem *item,
   dcac->dc.request_type = GENERAL_COMMAND;
 
   /* build the argument list */
-  dcac->command_args = g_hash_table_new_full((GHashFunc) g_str_hash,
-					     (GEqualFunc) g_str_equal,
-					     (GDestroyNotify) g_free,
-					     (GDestroyNotify) g_strfreev);
+  dcac->command_args = dropbox_args_new();
   {
     gchar **arglist;
     guint i;
@@ -493,18 +774,12 @@ menu_item_cb(NautilusMenuItem *item,
       i++;
     }
 
-    g_hash_table_insert(dcac->command_args,
-			g_strdup("paths"),
-			arglist);
+    dropbox_args_add(dcac->command_args, "paths",
+		     (const gchar * const *) arglist, i);
+    g_strfreev(arglist);
   }
 
-  {
-    gchar **arglist;
-    arglist = g_new(gchar *, 2);
-    arglist[0] = g_strdup(verb);
-    arglist[1] = NULL;
-    g_hash_table_insert(dcac->command_args, g_strdup("verb"), arglist);
-  }
+  dropbox_args_add_single(dcac->command_args, "verb", verb);
 
   dcac->command_name = g_strdup("icon_overlay_context_action");
   dcac->handler = NULL;
@@ -547,15 +822,42 @@ int GhettoURLDecode(gchar* out, gchar* in, int n) {
   return -1;
 }
 
-static int
-nautilus_dropbox_parse_menu(gchar			**options,
-			    NautilusMenu		*menu,
-			    GString			*old_action_string,
-			    GList			*toret,
-			    NautilusMenuProvider	*provider,
-			    GList			*files)
+/* a parsed entry of the icon_overlay_context_options reply, these are
+   cached by the raw option strings so we only have to parse a menu
+   the first time we see it */
+typedef struct {
+  gchar *action;
+  gchar *label;
+  gchar *tip;
+  gchar *verb;        /* NULL for submenus */
+  gboolean grayed_out;
+  GList *children;    /* list of DropboxMenuEntry, for submenus */
+} DropboxMenuEntry;
+
+/* we don't expect more than a handful of distinct menus */
+#define MENU_CACHE_MAX_ENTRIES 32
+
+static void
+menu_entry_list_free(GList *entries) {
+  GList *li;
+
+  for (li = entries; li != NULL; li = g_list_next(li)) {
+    DropboxMenuEntry *entry = (DropboxMenuEntry *) li->data;
+    g_free(entry->action);
+    g_free(entry->label);
+    g_free(entry->tip);
+    g_free(entry->verb);
+    menu_entry_list_free(entry->children);
+    g_free(entry);
+  }
+
+  g_list_free(entries);
+}
+
+static GList *
+nautilus_dropbox_parse_menu(gchar **options, const gchar *action_prefix)
 {
-  int ret = 0;
+  GList *entries = NULL;
   int i;
 
   for ( i = 0; options[i] != NULL; i++) {
@@ -570,6 +872,7 @@ nautilus_dropbox_parse_menu(gchar			**options,
     gchar* item_name = option_info[0];
     gchar* item_inner = option_info[1];
     gchar* verb = option_info[2];
+    DropboxMenuEntry *entry = g_new0(DropboxMenuEntry, 1);
 
     GhettoURLDecode(item_name, item_name, strlen(item_name));
     GhettoURLDecode(verb, verb, strlen(verb));
@@ -578,40 +881,101 @@ nautilus_dropbox_parse_menu(gchar			**options,
     // If the inner section has a menu in it then we create a submenu.  The verb will be ignored.
     // Otherwise add the verb to our map and add the menu item to the list.
     if (strchr(item_inner, '~') != NULL) {
-      GString *new_action_string = g_string_new(old_action_string->str);
       gchar **suboptions = g_strsplit(item_inner, "|", -1);
-      NautilusMenuItem *item;
-      NautilusMenu *submenu = nautilus_menu_new();
 
-      g_string_append(new_action_string, item_name);
-      g_string_append(new_action_string, "::");
-
-      ret += nautilus_dropbox_parse_menu(suboptions, submenu, new_action_string,
-					 toret, provider, files);
-
-      item = nautilus_menu_item_new(new_action_string->str,
-				    item_name, "", NULL);
-      nautilus_menu_item_set_submenu(item, submenu);
-      nautilus_menu_append_item(menu, item);
+      entry->action = g_strconcat(action_prefix, item_name, "::", NULL);
+      entry->label = g_strdup(item_name);
+      entry->tip = g_strdup("");
+      entry->children = nautilus_dropbox_parse_menu(suboptions, entry->action);
 
       g_strfreev(suboptions);
-      g_object_unref(item);
-      g_object_unref(submenu);
-      g_string_free(new_action_string, TRUE);
     } else {
-      NautilusMenuItem *item;
-      GString *new_action_string = g_string_new(old_action_string->str);
-      gboolean grayed_out = FALSE;
-
-      g_string_append(new_action_string, verb);
+      entry->action = g_strconcat(action_prefix, verb, NULL);
 
       if (item_name[0] == '!') {
 	  item_name++;
-	  grayed_out = TRUE;
+	  entry->grayed_out = TRUE;
       }
 
-      item = nautilus_menu_item_new(new_action_string->str, item_name, item_inner, NULL);
+      entry->label = g_strdup(item_name);
+      entry->tip = g_strdup(item_inner);
+      entry->verb = g_strdup(verb);
+    }
+
+    entries = g_list_append(entries, entry);
+    g_strfreev(option_info);
+  }
+  return entries;
+}
+
+static GList *
+nautilus_dropbox_lookup_menu(NautilusDropbox *cvs, gchar **options)
+{
+  GString *key;
+  GList *entries;
+  int i;
+
+  /* length prefix each option so distinct vectors never share a key */
+  key = g_string_new("");
+  for (i = 0; options[i] != NULL; i++) {
+    g_string_append_printf(key, "%u:", (guint) strlen(options[i]));
+    g_string_append(key, options[i]);
+  }
+
+  entries = g_hash_table_lookup(cvs->menu_cache, key->str);
+  if (entries == NULL) {
+    gchar **options_copy = g_strdupv(options);
+
+    /* parsing decodes the options in place */
+    entries = nautilus_dropbox_parse_menu(options_copy, "NautilusDropbox::");
+    g_strfreev(options_copy);
+
+    if (entries == NULL) {
+      g_string_free(key, TRUE);
+      return NULL;
+    }
+
+    if (g_hash_table_size(cvs->menu_cache) >= MENU_CACHE_MAX_ENTRIES) {
+      g_hash_table_remove_all(cvs->menu_cache);
+    }
+
+    g_hash_table_insert(cvs->menu_cache, g_string_free(key, FALSE), entries);
+  }
+  else {
+    g_string_free(key, TRUE);
+  }
+
+  return entries;
+}
+
+static int
+nautilus_dropbox_build_menu(GList			*entries,
+			    NautilusMenu		*menu,
+			    GList			*toret,
+			    NautilusMenuProvider	*provider,
+			    GList			*files)
+{
+  int ret = 0;
+  GList *li;
+
+  for (li = entries; li != NULL; li = g_list_next(li)) {
+    DropboxMenuEntry *entry = (DropboxMenuEntry *) li->data;
+    NautilusMenuItem *item;
+
+    item = nautilus_menu_item_new(entry->action, entry->label, entry->tip, NULL);
+
+    if (entry->verb == NULL) {
+      NautilusMenu *submenu = nautilus_menu_new();
 
+      ret += nautilus_dropbox_build_menu(entry->children, submenu,
+					 toret, provider, files);
+
+      nautilus_menu_item_set_submenu(item, submenu);
+      nautilus_menu_append_item(menu, item);
+
+      g_object_unref(item);
+      g_object_unref(submenu);
+    } else {
       nautilus_menu_append_item(menu, item);
       /* add the file metadata to this item */
       g_object_set_data_full (G_OBJECT(item), "nautilus_dropbox_files",
@@ -619,11 +983,11 @@ nautilus_dropbox_parse_menu(gchar			**options,
 			      (GDestroyNotify) nautilus_file_info_list_free);
       /* add the verb metadata */
       g_object_set_data_full (G_OBJECT(item), "nautilus_dropbox_verb",
-			      g_strdup(verb),
+			      g_strdup(entry->verb),
 			      (GDestroyNotify) g_free);
       g_signal_connect (item, "activate", G_CALLBACK (menu_item_cb), provider);
 
-      if (grayed_out) {
+      if (entry->grayed_out) {
 	GValue sensitive = { 0 };
 	g_value_init (&sensitive, G_TYPE_BOOLEAN);
 	g_value_set_boolean (&sensitive, FALSE);
@@ -638,23 +1002,21 @@ nautilus_dropbox_parse_menu(gchar			**options,
       }
 
       g_object_unref(item);
-      g_string_free(new_action_string, TRUE);
       ret++;
     }
-    g_strfreev(option_info);
   }
   return ret;
 }
 
 static void
-get_file_items_callback(GHashTable *response, gpointer ud)
+get_file_items_callback(DropboxArgs *response, gpointer ud)
 {
   GAsyncQueue *reply_queue = ud;
 
-  /* queue_push doesn't accept NULL as a value so we create an empty hash table
+  /* queue_push doesn't accept NULL as a value so we create an empty arg list
    * if we got no response. */
-  g_async_queue_push(reply_queue, response ? g_hash_table_ref(response) :
-		     g_hash_table_new((GHashFunc) g_str_hash, (GEqualFunc) g_str_equal));
+  g_async_queue_push(reply_queue, response ? dropbox_args_ref(response) :
+		     dropbox_args_new());
   g_async_queue_unref(reply_queue);
 }
 
@@ -693,7 +1055,7 @@ nautilus_dropbox_get_file_items(NautilusMenuProvider *provider,
     paths[i] = filename;
   }
 
-  GAsyncQueue *reply_queue = g_async_queue_new_full((GDestroyNotify)g_hash_table_unref);
+  GAsyncQueue *reply_queue = g_async_queue_new_full((GDestroyNotify)dropbox_args_unref);
   
   /*
    * 2. Create a DropboxGeneralCommand to call "icon_overlay_context_options"
@@ -702,11 +1064,9 @@ nautilus_dropbox_get_file_items(NautilusMenuProvider *provider,
   DropboxGeneralCommand *dgc = g_new0(DropboxGeneralCommand, 1);
   dgc->dc.request_type = GENERAL_COMMAND;
   dgc->command_name = g_strdup("icon_overlay_context_options");
-  dgc->command_args = g_hash_table_new_full((GHashFunc) g_str_hash,
-					    (GEqualFunc) g_str_equal,
-					    (GDestroyNotify) g_free,
-					    (GDestroyNotify) g_strfreev);
-  g_hash_table_insert(dgc->command_args, g_strdup("paths"), paths);
+  dgc->command_args = dropbox_args_new();
+  dropbox_args_add(dgc->command_args, "paths", (const gchar * const *) paths, -1);
+  g_strfreev(paths);
   dgc->handler = get_file_items_callback;
   dgc->handler_ud = g_async_queue_ref(reply_queue);
 
@@ -726,7 +1086,7 @@ nautilus_dropbox_get_file_items(NautilusMenuProvider *provider,
   g_get_current_time(&gtv);
   g_time_val_add(&gtv, 50000);
 
-  GHashTable *context_options_response = g_async_queue_timed_pop(reply_queue, &gtv);
+  DropboxArgs *context_options_response = g_async_queue_timed_pop(reply_queue, &gtv);
   g_async_queue_unref(reply_queue);
 
   if (!context_options_response) {
@@ -737,10 +1097,16 @@ nautilus_dropbox_get_file_items(NautilusMenuProvider *provider,
    * 5. Parse the reply.
    */
 
-  char **options = g_hash_table_lookup(context_options_response, "options");
+  char **options = dropbox_args_lookup(context_options_response, "options");
   GList *toret = NULL;
 
+  GList *entries = NULL;
+
   if (options && *options && **options)  {
+    entries = nautilus_dropbox_lookup_menu(cvs, options);
+  }
+
+  if (entries != NULL) {
     /* build the menu */
     NautilusMenuItem *root_item;
     NautilusMenu *root_menu;
@@ -750,27 +1116,27 @@ nautilus_dropbox_get_file_items(NautilusMenuProvider *provider,
 				       "Dropbox", "Dropbox Options", "dropbox");
 
     toret = g_list_append(toret, root_item);
-    GString *action_string = g_string_new("NautilusDropbox::");
 
-    if (!nautilus_dropbox_parse_menu(options, root_menu, action_string,
-				     toret, provider, files)) {
-	g_object_unref(toret);
+    if (!nautilus_dropbox_build_menu(entries, root_menu, toret,
+				     provider, files)) {
+	g_object_unref(root_item);
+	g_list_free(toret);
 	toret = NULL;
     }
+    else {
+	nautilus_menu_item_set_submenu(root_item, root_menu);
+    }
 
-    nautilus_menu_item_set_submenu(root_item, root_menu);
-
-    g_string_free(action_string, TRUE);
     g_object_unref(root_menu);
   }
 
-  g_hash_table_unref(context_options_response);
+  dropbox_args_unref(context_options_response);
 
   return toret;
 }
 
 gboolean
-add_emblem_paths(GHashTable* emblem_paths_response)
+add_emblem_paths(DropboxArgs* emblem_paths_response)
 {
   /* Only run this on the main loop or you'll cause problems. */
   if (!emblem_paths_response)
@@ -782,24 +1148,24 @@ add_emblem_paths(GHashTable* emblem_paths_response)
   GtkIconTheme *theme = gtk_icon_theme_get_default();
 
   if (emblem_paths_response &&
-      (emblem_paths_list = g_hash_table_lookup(emblem_paths_response, "path"))) {
+      (emblem_paths_list = dropbox_args_lookup(emblem_paths_response, "path"))) {
       for (i = 0; emblem_paths_list[i] != NULL; i++) {
 	if (emblem_paths_list[i][0])
 	  gtk_icon_theme_append_search_path(theme, emblem_paths_list[i]);
       }
   }
-  g_hash_table_unref(emblem_paths_response);
+  dropbox_args_unref(emblem_paths_response);
   return FALSE;
 }
 
 gboolean
-remove_emblem_paths(GHashTable* emblem_paths_response)
+remove_emblem_paths(DropboxArgs* emblem_paths_response)
 {
   /* Only run this on the main loop or you'll cause problems. */
   if (!emblem_paths_response)
     return FALSE;
 
-  gchar **emblem_paths_list = g_hash_table_lookup(emblem_paths_response, "path");
+  gchar **emblem_paths_list = dropbox_args_lookup(emblem_paths_response, "path");
   if (!emblem_paths_list)
       goto exit;
 
@@ -839,31 +1205,227 @@ remove_emblem_paths(GHashTable* emblem_paths_response)
 
   g_strfreev(paths);
 exit:
-  g_hash_table_unref(emblem_paths_response);
+  dropbox_args_unref(emblem_paths_response);
+  return FALSE;
+}
+
+static gboolean
+emblem_paths_equal(DropboxArgs *a, DropboxArgs *b) {
+  gchar **a_list, **b_list;
+  int i;
+
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  a_list = dropbox_args_lookup(a, "path");
+  b_list = dropbox_args_lookup(b, "path");
+  if (a_list == NULL || b_list == NULL)
+    return a_list == b_list;
+
+  for (i = 0; a_list[i] != NULL && b_list[i] != NULL; i++) {
+    if (strcmp(a_list[i], b_list[i]) != 0)
+      return FALSE;
+  }
+  return a_list[i] == b_list[i];
+}
+
+static gchar *
+emblem_paths_file(void) {
+  return g_build_filename(g_get_user_cache_dir(), "nautilus-dropbox",
+			  "emblem-paths", NULL);
+}
+
+/* the daemon only ever has a handful, anything past this is garbage */
+#define MAX_SAVED_EMBLEM_PATHS 64
+
+/* The paths from last session, one per line, so the emblems are there
+   before the daemon answers and a reconnect to the same daemon doesn't
+   touch the icon theme at all. */
+static DropboxArgs *
+emblem_paths_load(void) {
+  gchar *filename = emblem_paths_file();
+  gchar *contents = NULL;
+  DropboxArgs *toret = NULL;
+
+  if (g_file_get_contents(filename, &contents, NULL, NULL)) {
+    /* split it all, a limit here would glue the tail onto the last path */
+    gchar **lines = g_strsplit(contents, "\n", 0);
+    gchar **paths = g_new0(gchar *, MAX_SAVED_EMBLEM_PATHS + 1);
+    int i, j = 0;
+
+    for (i = 0; lines[i] != NULL && j < MAX_SAVED_EMBLEM_PATHS; i++) {
+      if (lines[i][0] == '/')
+	paths[j++] = lines[i];
+    }
+
+    if (j > 0) {
+      toret = dropbox_args_new();
+      dropbox_args_add(toret, "path", (const gchar * const *) paths, j);
+    }
+
+    g_free(paths);
+    g_strfreev(lines);
+    g_free(contents);
+  }
+
+  g_free(filename);
+  return toret;
+}
+
+static void
+emblem_paths_save(DropboxArgs *emblem_paths) {
+  gchar **emblem_paths_list = dropbox_args_lookup(emblem_paths, "path");
+  gchar *filename, *dirname, *contents;
+  GError *gerr = NULL;
+
+  if (emblem_paths_list == NULL)
+    return;
+
+  filename = emblem_paths_file();
+  dirname = g_path_get_dirname(filename);
+  contents = g_strjoinv("\n", emblem_paths_list);
+
+  if (g_mkdir_with_parents(dirname, 0700) < 0 ||
+      !g_file_set_contents(filename, contents, -1, &gerr)) {
+    debug("couldn't save emblem paths to %s: %s", filename,
+	  gerr != NULL ? gerr->message : g_strerror(errno));
+    if (gerr != NULL)
+      g_error_free(gerr);
+  }
+
+  g_free(contents);
+  g_free(dirname);
+  g_free(filename);
+}
+
+typedef struct {
+  NautilusDropbox *cvs;
+  DropboxArgs *emblem_paths;
+} DropboxEmblemPathsUpdate;
+
+static gboolean
+set_emblem_paths(DropboxEmblemPathsUpdate *depu) {
+  /* Only run this on the main loop or you'll cause problems. */
+  NautilusDropbox *cvs = depu->cvs;
+
+  /* a reconnect usually hands out the same paths, changing the search
+     path would make GTK rescan the theme and us redraw every file */
+  if (emblem_paths_equal(cvs->emblem_paths, depu->emblem_paths)) {
+    dropbox_args_unref(depu->emblem_paths);
+    g_free(depu);
+    return FALSE;
+  }
+
+  /* This call will free the data too. */
+  remove_emblem_paths(cvs->emblem_paths);
+  cvs->emblem_paths = depu->emblem_paths;
+  add_emblem_paths(dropbox_args_ref(cvs->emblem_paths));
+  emblem_paths_save(cvs->emblem_paths);
+  reset_all_files(cvs);
+
+  g_free(depu);
   return FALSE;
 }
 
-void get_emblem_paths_cb(GHashTable *emblem_paths_response, NautilusDropbox *cvs)
+void get_emblem_paths_cb(DropboxArgs *emblem_paths_response, NautilusDropbox *cvs)
 {
+  DropboxEmblemPathsUpdate *depu;
+
   if (!emblem_paths_response) {
-      emblem_paths_response = g_hash_table_new((GHashFunc) g_str_hash,
-					       (GEqualFunc) g_str_equal);
-      g_hash_table_insert(emblem_paths_response, "path", DEFAULT_EMBLEM_PATHS);
+      emblem_paths_response = dropbox_args_new();
+      dropbox_args_add(emblem_paths_response, "path",
+		       (const gchar * const *) DEFAULT_EMBLEM_PATHS, -1);
   } else {
       /* Increase the ref so that finish_general_command doesn't delete it. */
-      g_hash_table_ref(emblem_paths_response);
+      dropbox_args_ref(emblem_paths_response);
   }
 
-  g_mutex_lock(cvs->emblem_paths_mutex);
-  if (cvs->emblem_paths) {
-    g_idle_add((GSourceFunc) remove_emblem_paths, cvs->emblem_paths);
-    cvs->emblem_paths = NULL;
+  depu = g_new(DropboxEmblemPathsUpdate, 1);
+  depu->cvs = cvs;
+  depu->emblem_paths = emblem_paths_response;
+  g_idle_add((GSourceFunc) set_emblem_paths, depu);
+}
+
+typedef struct {
+  NautilusDropbox *cvs;
+  guint connection;
+  gchar **root_paths;
+} DropboxRootPathsUpdate;
+
+static gboolean
+set_root_paths(DropboxRootPathsUpdate *drpu) {
+  /* Only run this on the main loop or you'll cause problems. */
+  NautilusDropbox *cvs = drpu->cvs;
+
+  /* an answer from before the last disconnect might be about a
+     different daemon */
+  if (drpu->connection == cvs->connection) {
+    g_strfreev(cvs->root_paths);
+    cvs->root_paths = drpu->root_paths;
+  }
+  else {
+    g_strfreev(drpu->root_paths);
   }
-  cvs->emblem_paths = emblem_paths_response;
-  g_mutex_unlock(cvs->emblem_paths_mutex);
 
-  g_idle_add((GSourceFunc) add_emblem_paths, g_hash_table_ref(emblem_paths_response));
-  g_idle_add((GSourceFunc) reset_all_files, cvs);
+  g_free(drpu);
+  return FALSE;
+}
+
+static void
+add_root_path(gchar **root_paths, int *n, gchar *root_path) {
+  int i;
+
+  for (i = 0; i < *n; i++) {
+    if (strcmp(root_paths[i], root_path) == 0) {
+      g_free(root_path);
+      return;
+    }
+  }
+  root_paths[(*n)++] = root_path;
+}
+
+/* runs on the command thread, ud is the DropboxRootPathsUpdate to fill */
+static void
+get_root_paths_cb(DropboxArgs *root_paths_response,
+		  DropboxRootPathsUpdate *drpu) {
+  gchar **root_paths_list;
+  int i, j = 0;
+
+  /* older daemons answer notok, and a failed connection gets us here
+     with nothing at all.  Either way root_paths stays NULL and every
+     lookup goes to the daemon like it used to; there's nothing to
+     install, set_root_paths would only be told NULL again. */
+  if (root_paths_response == NULL ||
+      (root_paths_list = dropbox_args_lookup(root_paths_response, "path")) == NULL) {
+    g_free(drpu);
+    return;
+  }
+
+  /* room for the path as reported and resolved for each */
+  drpu->root_paths = g_new0(gchar *, 2 * g_strv_length(root_paths_list) + 1);
+  for (i = 0; root_paths_list[i] != NULL; i++) {
+    gchar *root_path, *resolved;
+
+    if (root_paths_list[i][0] != '/' ||
+	(root_path = canonicalize_path(root_paths_list[i])) == NULL) {
+      continue;
+    }
+
+    /* we're on the command thread, touching the disk is fine here */
+    if ((resolved = realpath(root_path, NULL)) != NULL) {
+      add_root_path(drpu->root_paths, &j, g_strdup(resolved));
+      free(resolved);
+    }
+    add_root_path(drpu->root_paths, &j, root_path);
+  }
+
+  if (j == 0) {
+    g_free(drpu->root_paths);
+    g_free(drpu);
+    return;
+  }
+
+  g_idle_add((GSourceFunc) set_root_paths, drpu);
 }
 
 static void
@@ -873,17 +1435,37 @@ on_connect(NautilusDropbox *cvs) {
   dropbox_command_client_send_command(&(cvs->dc.dcc),
 				      (NautilusDropboxCommandResponseHandler) get_emblem_paths_cb,
 				      cvs, "get_emblem_paths", NULL);
+  {
+    DropboxRootPathsUpdate *drpu = g_new0(DropboxRootPathsUpdate, 1);
+
+    drpu->cvs = cvs;
+    drpu->connection = cvs->connection;
+    dropbox_command_client_send_command(&(cvs->dc.dcc),
+					(NautilusDropboxCommandResponseHandler) get_root_paths_cb,
+					drpu, "get_dropbox_folder", NULL);
+  }
 }
 
 static void
 on_disconnect(NautilusDropbox *cvs) {
   reset_all_files(cvs);
 
-  g_mutex_lock(cvs->emblem_paths_mutex);
-  /* This call will free the data too. */
-  g_idle_add((GSourceFunc) remove_emblem_paths, cvs->emblem_paths);
-  cvs->emblem_paths = NULL;
-  g_mutex_unlock(cvs->emblem_paths_mutex);
+  debug("%" G_GUINT64_FORMAT " lookups outside of dropbox skipped",
+	cvs->rejected_lookups);
+  tracked_files_report(cvs);
+
+  /* the folders might move while we're gone, and answers still on
+     their way are about the old ones */
+  g_strfreev(cvs->root_paths);
+  cvs->root_paths = NULL;
+  cvs->connection++;
+
+  /* a new daemon might hand out different verbs */
+  g_hash_table_remove_all(cvs->menu_cache);
+  g_hash_table_remove_all(cvs->pushed_emblems);
+
+  /* the emblem paths stay put, set_emblem_paths swaps them if the next
+     daemon has different ones */
 }
 
 
@@ -910,8 +1492,34 @@ nautilus_dropbox_instance_init (NautilusDropbox *cvs) {
 					    (GEqualFunc) g_direct_equal,
 					    (GDestroyNotify) NULL,
 					    (GDestroyNotify) g_free);
-  cvs->emblem_paths_mutex = g_mutex_new();
-  cvs->emblem_paths = NULL;
+  cvs->max_tracked_files = 0;
+  cvs->tracked_lru = NULL;
+  cvs->obj2lru = NULL;
+  cvs->evicted_files = 0;
+  if ((cvs->max_tracked_files = max_tracked_files_from_env()) > 0) {
+    cvs->tracked_lru = g_queue_new();
+    cvs->obj2lru = g_hash_table_new((GHashFunc) g_direct_hash,
+				    (GEqualFunc) g_direct_equal);
+  }
+  cvs->emblem_paths = emblem_paths_load();
+  if (cvs->emblem_paths)
+    add_emblem_paths(dropbox_args_ref(cvs->emblem_paths));
+  cvs->root_paths = NULL;
+  cvs->connection = 0;
+  cvs->rejected_lookups = 0;
+  cvs->pending_touches = g_hash_table_new_full((GHashFunc) g_str_hash,
+					       (GEqualFunc) g_str_equal,
+					       (GDestroyNotify) g_free,
+					       (GDestroyNotify) NULL);
+  cvs->touch_flush_source = 0;
+  cvs->pushed_emblems = g_hash_table_new_full((GHashFunc) g_str_hash,
+					      (GEqualFunc) g_str_equal,
+					      (GDestroyNotify) g_free,
+					      (GDestroyNotify) g_strfreev);
+  cvs->menu_cache = g_hash_table_new_full((GHashFunc) g_str_hash,
+					  (GEqualFunc) g_str_equal,
+					  (GDestroyNotify) g_free,
+					  (GDestroyNotify) menu_entry_list_free);
 
   /* setup the connection obj*/
   dropbox_client_setup(&(cvs->dc));
@@ -919,6 +1527,8 @@ nautilus_dropbox_instance_init (NautilusDropbox *cvs) {
   /* our hooks */
   nautilus_dropbox_hooks_add(&(cvs->dc.hookserv), "shell_touch",
 			     (DropboxUpdateHook) handle_shell_touch, cvs);
+  nautilus_dropbox_hooks_add(&(cvs->dc.hookserv), "shell_emblems",
+			     (DropboxUpdateHook) handle_shell_emblems, cvs);
 
   /* add connection handlers */
   dropbox_client_add_on_connect_hook(&(cvs->dc),
@@ -49,8 +49,18 @@ struct _NautilusDropbox {
   GObject parent_slot;
   GHashTable *filename2obj;
   GHashTable *obj2filename;
-  GMutex *emblem_paths_mutex;
-  GHashTable *emblem_paths;
+  DropboxArgs *emblem_paths;
+  GHashTable *menu_cache;
+  gchar **root_paths;
+  guint connection;           /* bumped on every disconnect */
+  guint64 rejected_lookups;
+  GHashTable *pending_touches;
+  guint touch_flush_source;
+  GHashTable *pushed_emblems;
+  guint max_tracked_files;    /* 0 for no limit */
+  GQueue *tracked_lru;        /* tracked files, most recently asked about first */
+  GHashTable *obj2lru;        /* file -> its link in tracked_lru */
+  guint64 evicted_files;
   DropboxClient dc;
 };
 
@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+#
+# Copyright 2008 Evenflow, Inc.
+#
+# bench-startup.py
+# Times how long the dropbox CLI takes to start and answer.
+#
+# This file is part of nautilus-dropbox.
+#
+# nautilus-dropbox is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# nautilus-dropbox is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Run by "make bench-startup" as bench-startup.py [-n RUNS] SCRIPT with
+# mock-dropboxd.py serving $HOME/.dropbox.  Login scripts and panels run
+# "dropbox running" and "dropbox status" over and over, so for each it
+# prints the median wall time of a whole run, interpreter startup
+# included, and how many modules the script imported on top of what a
+# bare interpreter already has.
+
+import optparse
+import os
+import subprocess
+import sys
+import time
+
+COMMANDS = [['running'], ['status']]
+
+# runs the script like python would and reports what it imported on the
+# way, even if it leaves through sys.exit
+COUNT_MODULES = r'''
+import atexit, runpy, sys
+before = set(name for name, module in sys.modules.items() if module is not None)
+def report():
+    after = set(name for name, module in sys.modules.items() if module is not None)
+    sys.stderr.write("\nimported modules: %d\n" % len(after - before))
+atexit.register(report)
+sys.argv = sys.argv[1:]
+runpy.run_path(sys.argv[0], run_name='__main__')
+'''
+
+def run_once(argv):
+    devnull = open(os.devnull, 'w')
+    try:
+        start = time.time()
+        subprocess.call(argv, stdout=devnull)
+        return time.time() - start
+    finally:
+        devnull.close()
+
+def count_modules(script, command):
+    devnull = open(os.devnull, 'w')
+    try:
+        p = subprocess.Popen([sys.executable, '-c', COUNT_MODULES, script] + command,
+                             stdout=devnull, stderr=subprocess.PIPE)
+        err = p.communicate()[1]
+    finally:
+        devnull.close()
+    for line in err.splitlines():
+        if line.startswith('imported modules: '):
+            return int(line.split()[-1])
+    sys.stderr.write(err)
+    return None
+
+def wait_for_daemon(timeout=10):
+    # the mock is started alongside us, timing it coming up isn't the point
+    dotdir = os.path.expanduser('~/.dropbox')
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if (os.path.exists(os.path.join(dotdir, 'dropbox.pid')) and
+            os.path.exists(os.path.join(dotdir, 'command_socket'))):
+            return True
+        time.sleep(0.05)
+    return False
+
+def median(values):
+    values = sorted(values)
+    mid = len(values) // 2
+    if len(values) % 2:
+        return values[mid]
+    return (values[mid - 1] + values[mid]) / 2.0
+
+def main(argv):
+    parser = optparse.OptionParser(usage="%prog [options] SCRIPT")
+    parser.add_option("-n", type="int", dest="runs", default=20,
+                      help="runs per command (default: 20)")
+    opts, args = parser.parse_args(argv[1:])
+    if len(args) != 1 or opts.runs < 1:
+        parser.error("need the dropbox script and at least one run")
+    script = args[0]
+    if not wait_for_daemon():
+        sys.stderr.write("no daemon under ~/.dropbox\n")
+        return 1
+
+    good = True
+    for command in COMMANDS:
+        argv = [sys.executable, script] + command
+        # one run first to warm the page cache
+        run_once(argv)
+        times = [run_once(argv) for i in range(opts.runs)]
+        modules = count_modules(script, command)
+        if modules is None:
+            good = False
+        print "dropbox %s: median %.1fms over %d runs (min %.1fms), %s imported modules" % (
+            ' '.join(command), median(times) * 1000, opts.runs, min(times) * 1000,
+            modules if modules is not None else "??")
+    return 0 if good else 1
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
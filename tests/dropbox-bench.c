@@ -0,0 +1,265 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-bench.c
+ * Headless file info throughput and latency benchmark for the extension.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+  Runs the extension's info provider against whatever serves
+  $HOME/.dropbox/command_socket (normally mock-dropboxd.py, see "make
+  bench") without nautilus.  Each request is a StubFileInfo handed to
+  nautilus_info_provider_update_file_info with an update_complete closure,
+  just like nautilus showing a folder, and is timed until the closure
+  fires.  A timer ticking on the main loop catches anything that blocks
+  it, and peak RSS comes from getrusage at the end.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "dropbox-log.h"
+#include "stub-file-info.h"
+
+#define TICK_MS 10
+
+typedef struct _Bench Bench;
+
+typedef struct {
+  Bench *b;
+  GTimeVal queued_at;
+} BenchRequest;
+
+struct _Bench {
+  NautilusDropbox *cvs;
+  GMainLoop *loop;
+  guint requests;
+  guint window;
+  guint sent;
+  guint completed;
+  guint failed;
+  glong *latencies;
+  StubFileInfo **files;
+  GTimeVal started;
+  gboolean running;
+  GTimeVal last_tick;
+  glong max_stall_usec;
+};
+
+static Bench bench;
+
+static glong
+timeval_diff_usec(GTimeVal *from, GTimeVal *to) {
+  return (to->tv_sec - from->tv_sec) * G_USEC_PER_SEC +
+    (to->tv_usec - from->tv_usec);
+}
+
+static int
+compare_glong(gconstpointer a, gconstpointer b) {
+  glong x = *(const glong *) a, y = *(const glong *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+report(Bench *b) {
+  struct rusage ru;
+  GTimeVal now;
+  gdouble elapsed;
+  guint n = b->completed - b->failed;
+
+  g_get_current_time(&now);
+  elapsed = timeval_diff_usec(&(b->started), &now) / (gdouble) G_USEC_PER_SEC;
+  getrusage(RUSAGE_SELF, &ru);
+
+  g_print("%u requests (%u failed) in %.3fs, %.0f requests/s\n",
+	  b->completed, b->failed, elapsed,
+	  elapsed > 0 ? b->completed / elapsed : 0.0);
+  if (n > 0) {
+    qsort(b->latencies, n, sizeof(glong), compare_glong);
+    g_print("latency p50 %ldus p90 %ldus p99 %ldus max %ldus\n",
+	    b->latencies[n / 2], b->latencies[n * 9 / 10],
+	    b->latencies[n * 99 / 100], b->latencies[n - 1]);
+  }
+  g_print("max main loop stall %ldus, peak rss %ldkB, %u files tracked\n",
+	  b->max_stall_usec, ru.ru_maxrss,
+	  g_hash_table_size(b->cvs->obj2filename));
+}
+
+static void
+request_done(Bench *b, BenchRequest *br, gboolean ok) {
+  GTimeVal now;
+
+  g_get_current_time(&now);
+  if (!ok) {
+    b->failed++;
+  }
+  else {
+    b->latencies[b->completed - b->failed] =
+      timeval_diff_usec(&(br->queued_at), &now);
+  }
+  b->completed++;
+
+  if (b->completed == b->requests) {
+    report(b);
+    g_main_loop_quit(b->loop);
+  }
+}
+
+static void send_request(Bench *b);
+
+static void
+fill_window(Bench *b) {
+  while (b->sent < b->requests && b->sent - b->completed < b->window) {
+    send_request(b);
+  }
+}
+
+static void
+update_complete(BenchRequest *br, NautilusOperationHandle *handle,
+		NautilusOperationResult result) {
+  request_done(br->b, br, result == NAUTILUS_OPERATION_COMPLETE);
+  fill_window(br->b);
+}
+
+static void
+send_request(Bench *b) {
+  BenchRequest *br = g_new0(BenchRequest, 1);
+  NautilusOperationHandle *handle = NULL;
+  NautilusOperationResult result;
+  GClosure *closure;
+  gchar *basename, *filename;
+  StubFileInfo *file;
+
+  basename = g_strdup_printf("file-%u", b->sent);
+  filename = g_build_filename(g_get_home_dir(), "Dropbox", basename, NULL);
+  /* every tenth one also asks for a folder tag.  nautilus keeps the
+     files of the folders it shows around, so do we */
+  file = b->files[b->sent] = stub_file_info_new(filename, b->sent % 10 == 0);
+  g_free(filename);
+  g_free(basename);
+
+  br->b = b;
+  closure = stub_update_complete_new((StubUpdateComplete) update_complete,
+				     br, (GClosureNotify) g_free);
+
+  b->sent++;
+  g_get_current_time(&(br->queued_at));
+  result = nautilus_info_provider_update_file_info(NAUTILUS_INFO_PROVIDER(b->cvs),
+						   NAUTILUS_FILE_INFO(file),
+						   closure, &handle);
+  if (result != NAUTILUS_OPERATION_IN_PROGRESS) {
+    /* answered on the spot, the closure won't fire.  It also answers
+       like that when the daemon is gone, which doesn't count */
+    request_done(b, br, result == NAUTILUS_OPERATION_COMPLETE &&
+		 dropbox_client_is_connected(&(b->cvs->dc)));
+  }
+  g_closure_unref(closure);
+}
+
+/* a tick that shows up late means something hogged the main loop */
+static gboolean
+tick(Bench *b) {
+  GTimeVal now;
+  glong late;
+
+  g_get_current_time(&now);
+  late = timeval_diff_usec(&(b->last_tick), &now) - TICK_MS * 1000;
+  if (b->running && late > b->max_stall_usec) {
+    b->max_stall_usec = late;
+  }
+  b->last_tick = now;
+
+  return TRUE;
+}
+
+static gboolean
+wait_for_provider(Bench *b) {
+  if (!stub_provider_ready(b->cvs))
+    return TRUE;
+
+  b->running = TRUE;
+  g_get_current_time(&(b->started));
+  fill_window(b);
+  return FALSE;
+}
+
+static gboolean
+on_timeout(Bench *b) {
+  g_printerr("gave up after %u of %u requests\n", b->completed, b->requests);
+  exit(1);
+  return FALSE;
+}
+
+int
+main(int argc, char **argv) {
+  int i;
+
+  bench.requests = 10000;
+  bench.window = 64;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      bench.requests = strtoul(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      bench.window = strtoul(argv[++i], NULL, 10);
+    }
+    else {
+      g_printerr("usage: %s [-n REQUESTS] [-w IN FLIGHT]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (bench.requests == 0 || bench.window == 0) {
+    g_printerr("need at least one request in flight\n");
+    return 2;
+  }
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+  if (!g_thread_supported())
+    g_thread_init(NULL);
+#endif
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+  g_type_init();
+#endif
+  dropbox_log_init();
+
+  bench.latencies = g_new(glong, bench.requests);
+  bench.files = g_new0(StubFileInfo *, bench.requests);
+  bench.loop = g_main_loop_new(NULL, FALSE);
+  bench.cvs = stub_provider_new();
+
+  g_get_current_time(&(bench.last_tick));
+  g_timeout_add(TICK_MS, (GSourceFunc) tick, &bench);
+  g_timeout_add(10, (GSourceFunc) wait_for_provider, &bench);
+
+  /* generous, a stuck daemon shouldn't hang make */
+  g_timeout_add(600 * 1000, (GSourceFunc) on_timeout, &bench);
+  g_main_loop_run(bench.loop);
+
+  for (i = 0; i < bench.requests; i++) {
+    g_object_unref(bench.files[i]);
+  }
+
+  return bench.failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,370 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * dropbox-stress.c
+ * Concurrency stress driver for the command thread and the main loop.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+  Meant to be built with --enable-tsan and run by "make stress" against
+  a mock-dropboxd.py that fails commands, drops connections and pushes
+  shell_touch bursts.  Like the extension it runs the hook connection
+  and the command thread together: file info requests and general
+  commands are in flight all the time, their results come back on the
+  main loop (general command handlers run on the command thread and
+  hand off with g_idle_add, like the extension's do), and every so often
+  the main loop forces a reconnect in the middle of it all.  The main
+  loop also cancels a random share of the file info requests in flight
+  the way nautilus_dropbox_cancel_update does, while the command thread
+  is busy answering them.
+
+  When the time is up we stop sending and wait for everything in flight
+  to come back, failed or not.  A request that never comes back or a
+  cancelled one that comes back twice is a bug, and TSan makes the
+  process exit non zero if it saw a race.
+*/
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "dropbox-log.h"
+#include "dropbox-tsan.h"
+#include "dropbox-client.h"
+
+typedef struct {
+  DropboxFileInfoCommand dfic; /* first, the command client hands it back */
+  guint finished;
+} StressRequest;
+
+typedef struct {
+  DropboxClient dc;
+  GMainLoop *loop;
+  guint seconds;
+  guint window;
+  gboolean stopping;
+  guint serial;
+  /* everything below is only touched on the main loop */
+  guint file_info_in_flight;
+  guint general_in_flight;
+  GHashTable *requests;       /* file info requests in flight */
+  GSList *cancelled;          /* kept until the end to see them finish */
+  guint file_info_done;
+  guint file_info_failed;
+  guint file_info_cancelled;
+  guint bad;
+  guint general_done;
+  guint general_failed;
+  guint touches;
+  guint connects;
+  guint disconnects;
+  guint forced_reconnects;
+} Stress;
+
+static Stress stress;
+
+typedef struct {
+  Stress *s;
+  DropboxArgs *response;
+} GeneralResult;
+
+static void
+check_done(Stress *s) {
+  if (!s->stopping || s->file_info_in_flight > 0 || s->general_in_flight > 0)
+    return;
+
+  g_print("file info: %u done, %u failed, %u cancelled\n",
+	  s->file_info_done, s->file_info_failed, s->file_info_cancelled);
+  g_print("general commands: %u done, %u failed\n",
+	  s->general_done, s->general_failed);
+  g_print("%u shell_touch, %u connects, %u disconnects, %u forced reconnects\n",
+	  s->touches, s->connects, s->disconnects, s->forced_reconnects);
+  g_main_loop_quit(s->loop);
+}
+
+static void
+send_file_info(Stress *s) {
+  StressRequest *sr = g_new0(StressRequest, 1);
+  gchar *basename = g_strdup_printf("file-%u", s->serial % 1000);
+
+  sr->dfic.dc.request_type = GET_FILE_INFO;
+  sr->dfic.filename = g_build_filename(g_get_home_dir(), "Dropbox",
+				       basename, NULL);
+  sr->dfic.is_directory = s->serial % 7 == 0;
+  g_free(basename);
+
+  s->serial++;
+  s->file_info_in_flight++;
+  g_hash_table_insert(s->requests, sr, sr);
+  dropbox_command_client_request(&(s->dc.dcc), (DropboxCommand *) sr);
+}
+
+static void
+free_response(DropboxFileInfoCommandResponse *dficr) {
+  if (dficr->file_status_response != NULL)
+    dropbox_args_unref(dficr->file_status_response);
+  if (dficr->folder_tag_response != NULL)
+    dropbox_args_unref(dficr->folder_tag_response);
+  if (dficr->emblems_response != NULL)
+    dropbox_args_unref(dficr->emblems_response);
+  g_free(dficr);
+}
+
+/* the command client calls this on the main loop, in the extension it
+   lives in nautilus-dropbox.c */
+gboolean
+nautilus_dropbox_finish_file_info_command(DropboxFileInfoCommandResponse *dficr) {
+  Stress *s = &stress;
+  StressRequest *sr = (StressRequest *) dficr->dfic;
+
+  /* cancelled requests aren't freed until the end, so a second finish
+     lands here instead of in freed memory */
+  if (!g_hash_table_remove(s->requests, sr)) {
+    g_printerr("file info request for %s finished again\n", sr->dfic.filename);
+    s->bad++;
+    free_response(dficr);
+    return FALSE;
+  }
+  sr->finished++;
+
+  if (sr->dfic.cancelled)
+    s->file_info_cancelled++;
+  else if (dficr->file_status_response == NULL && dficr->emblems_response == NULL)
+    s->file_info_failed++;
+  else
+    s->file_info_done++;
+  s->file_info_in_flight--;
+
+  free_response(dficr);
+  if (!sr->dfic.cancelled) {
+    g_free(sr->dfic.filename);
+    g_free(sr);
+  }
+
+  if (!s->stopping)
+    send_file_info(s);
+  else
+    check_done(s);
+
+  return FALSE;
+}
+
+static gboolean
+finish_general(GeneralResult *gr) {
+  Stress *s = gr->s;
+
+  if (gr->response == NULL) {
+    s->general_failed++;
+  }
+  else {
+    s->general_done++;
+    dropbox_args_unref(gr->response);
+  }
+  s->general_in_flight--;
+  g_free(gr);
+
+  check_done(s);
+  return FALSE;
+}
+
+/* on the command thread */
+static void
+general_response(DropboxArgs *response, Stress *s) {
+  GeneralResult *gr = g_new(GeneralResult, 1);
+
+  gr->s = s;
+  gr->response = response != NULL ? dropbox_args_ref(response) : NULL;
+  g_idle_add((GSourceFunc) finish_general, gr);
+}
+
+static gboolean
+send_general(Stress *s) {
+  gchar *path;
+
+  if (s->stopping)
+    return FALSE;
+
+  path = g_build_filename(g_get_home_dir(), "Dropbox", "folder", NULL);
+  s->general_in_flight++;
+  if (s->serial % 2 == 0) {
+    dropbox_command_client_send_command(&(s->dc.dcc),
+					(NautilusDropboxCommandResponseHandler)
+					general_response, s,
+					"icon_overlay_context_options",
+					"paths", path, NULL);
+  }
+  else {
+    dropbox_command_client_send_command(&(s->dc.dcc),
+					(NautilusDropboxCommandResponseHandler)
+					general_response, s,
+					"get_emblem_paths", NULL);
+  }
+  g_free(path);
+
+  return TRUE;
+}
+
+static void
+maybe_cancel(StressRequest *sr, gpointer value, Stress *s) {
+  if (!sr->dfic.cancelled && g_random_int_range(0, 8) == 0) {
+    sr->dfic.cancelled = TRUE;
+    s->cancelled = g_slist_prepend(s->cancelled, sr);
+  }
+}
+
+/* like nautilus giving up on a file while we're still asking about it,
+   this keeps going through the drain at the end too */
+static gboolean
+cancel_some(Stress *s) {
+  g_hash_table_foreach(s->requests, (GHFunc) maybe_cancel, s);
+  return TRUE;
+}
+
+static guint
+check_cancelled(Stress *s) {
+  guint wrong = 0;
+  GSList *li;
+
+  for (li = s->cancelled; li != NULL; li = g_slist_next(li)) {
+    StressRequest *sr = li->data;
+
+    if (sr->finished != 1) {
+      g_printerr("cancelled request for %s finished %u times\n",
+		 sr->dfic.filename, sr->finished);
+      wrong++;
+    }
+    g_free(sr->dfic.filename);
+    g_free(sr);
+  }
+  g_slist_free(s->cancelled);
+  s->cancelled = NULL;
+
+  return wrong;
+}
+
+static void
+on_touch(DropboxArgs *args, Stress *s) {
+  s->touches++;
+}
+
+static gboolean
+force_reconnect(Stress *s) {
+  if (s->stopping)
+    return FALSE;
+
+  if (dropbox_client_is_connected(&(s->dc))) {
+    s->forced_reconnects++;
+    dropbox_client_force_reconnect(&(s->dc));
+  }
+
+  return TRUE;
+}
+
+static void
+on_connect(Stress *s) {
+  guint i;
+
+  s->connects++;
+  /* requests failed by the last disconnect already refilled the window */
+  for (i = s->file_info_in_flight; i < s->window && !s->stopping; i++) {
+    send_file_info(s);
+  }
+}
+
+static void
+on_disconnect(Stress *s) {
+  s->disconnects++;
+}
+
+static gboolean
+stop(Stress *s) {
+  s->stopping = TRUE;
+  check_done(s);
+  return FALSE;
+}
+
+static gboolean
+on_timeout(Stress *s) {
+  g_printerr("stuck: %u file info and %u general commands never came back\n",
+	     s->file_info_in_flight, s->general_in_flight);
+  exit(1);
+  return FALSE;
+}
+
+int
+main(int argc, char **argv) {
+  int i;
+
+  stress.seconds = 10;
+  stress.window = 32;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      stress.seconds = strtoul(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      stress.window = strtoul(argv[++i], NULL, 10);
+    }
+    else {
+      g_printerr("usage: %s [-t SECONDS] [-w IN FLIGHT]\n", argv[0]);
+      return 2;
+    }
+  }
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+  if (!g_thread_supported())
+    g_thread_init(NULL);
+#endif
+  dropbox_log_init();
+  /* nautilus ignores it too, dropped connections show up as write errors */
+  signal(SIGPIPE, SIG_IGN);
+
+  stress.loop = g_main_loop_new(NULL, FALSE);
+  stress.requests = g_hash_table_new((GHashFunc) g_direct_hash,
+				     (GEqualFunc) g_direct_equal);
+
+  dropbox_client_setup(&(stress.dc));
+  nautilus_dropbox_hooks_add(&(stress.dc.hookserv), "shell_touch",
+			     (DropboxUpdateHook) on_touch, &stress);
+  dropbox_client_add_on_connect_hook(&(stress.dc),
+				     (DropboxClientConnectHook) on_connect,
+				     &stress);
+  dropbox_client_add_on_disconnect_hook(&(stress.dc),
+					(DropboxClientConnectHook) on_disconnect,
+					&stress);
+  dropbox_client_start(&(stress.dc));
+
+  g_timeout_add(5, (GSourceFunc) send_general, &stress);
+  g_timeout_add(700, (GSourceFunc) force_reconnect, &stress);
+  g_timeout_add(2, (GSourceFunc) cancel_some, &stress);
+  g_timeout_add(stress.seconds * 1000, (GSourceFunc) stop, &stress);
+  /* everything in flight should be back well within a minute */
+  g_timeout_add((stress.seconds + 60) * 1000, (GSourceFunc) on_timeout, &stress);
+  g_main_loop_run(stress.loop);
+
+  stress.bad += check_cancelled(&stress);
+  if (stress.file_info_cancelled == 0) {
+    g_printerr("nothing got cancelled\n");
+    stress.bad++;
+  }
+
+  return stress.connects > 0 && stress.bad == 0 ? 0 : 1;
+}
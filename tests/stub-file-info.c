@@ -0,0 +1,265 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * stub-file-info.c
+ * Stand-in nautilus file objects for driving the extension in tests.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+  Nautilus hands the extension NautilusFile objects, which implement the
+  NautilusFileInfo interface and have a "changed" signal.  StubFileInfo
+  does the same for the handful of calls nautilus-dropbox.c makes, so the
+  tests can go through the real update_file_info and
+  finish_file_info_command instead of reimplementing them.
+*/
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gtk/gtk.h>
+
+#include "stub-file-info.h"
+
+static GObjectClass *parent_class;
+
+static gboolean
+stub_file_info_is_gone(NautilusFileInfo *file) {
+  return STUB_FILE_INFO(file)->is_gone;
+}
+
+static char *
+stub_file_info_get_uri(NautilusFileInfo *file) {
+  return g_strdup(STUB_FILE_INFO(file)->uri);
+}
+
+static gboolean
+stub_file_info_is_directory(NautilusFileInfo *file) {
+  return STUB_FILE_INFO(file)->is_directory;
+}
+
+static void
+stub_file_info_add_emblem(NautilusFileInfo *file, const char *emblem_name) {
+  g_ptr_array_add(STUB_FILE_INFO(file)->emblems, g_strdup(emblem_name));
+}
+
+static void
+clear_emblems(StubFileInfo *file) {
+  guint i;
+
+  for (i = 0; i < file->emblems->len; i++) {
+    g_free(g_ptr_array_index(file->emblems, i));
+  }
+  g_ptr_array_set_size(file->emblems, 0);
+}
+
+static void
+stub_file_info_invalidate_extension_info(NautilusFileInfo *file) {
+  /* nautilus drops what the extensions said and asks again later */
+  clear_emblems(STUB_FILE_INFO(file));
+  STUB_FILE_INFO(file)->invalidated++;
+}
+
+static void
+stub_file_info_iface_init(NautilusFileInfoIface *iface) {
+  iface->is_gone = stub_file_info_is_gone;
+  iface->get_uri = stub_file_info_get_uri;
+  iface->is_directory = stub_file_info_is_directory;
+  iface->add_emblem = stub_file_info_add_emblem;
+  iface->invalidate_extension_info = stub_file_info_invalidate_extension_info;
+}
+
+static void
+stub_file_info_finalize(GObject *object) {
+  StubFileInfo *file = STUB_FILE_INFO(object);
+
+  clear_emblems(file);
+  g_ptr_array_free(file->emblems, TRUE);
+  g_free(file->uri);
+
+  parent_class->finalize(object);
+}
+
+static void
+stub_file_info_class_init(StubFileInfoClass *class) {
+  parent_class = g_type_class_peek_parent(class);
+  G_OBJECT_CLASS(class)->finalize = stub_file_info_finalize;
+
+  /* NautilusFile's, the provider listens for renames on it */
+  g_signal_new("changed", G_TYPE_FROM_CLASS(class), G_SIGNAL_RUN_LAST,
+	       0, NULL, NULL, g_cclosure_marshal_VOID__VOID, G_TYPE_NONE, 0);
+}
+
+static void
+stub_file_info_instance_init(StubFileInfo *file) {
+  file->emblems = g_ptr_array_new();
+}
+
+GType
+stub_file_info_get_type(void) {
+  static GType type = 0;
+
+  if (type == 0) {
+    static const GTypeInfo info = {
+      sizeof (StubFileInfoClass),
+      (GBaseInitFunc) NULL,
+      (GBaseFinalizeFunc) NULL,
+      (GClassInitFunc) stub_file_info_class_init,
+      (GClassFinalizeFunc) NULL,
+      NULL,
+      sizeof (StubFileInfo),
+      0,
+      (GInstanceInitFunc) stub_file_info_instance_init,
+    };
+
+    static const GInterfaceInfo file_info_iface_info = {
+      (GInterfaceInitFunc) stub_file_info_iface_init,
+      NULL,
+      NULL
+    };
+
+    type = g_type_register_static(G_TYPE_OBJECT, "StubFileInfo", &info, 0);
+    g_type_add_interface_static(type, NAUTILUS_TYPE_FILE_INFO,
+				&file_info_iface_info);
+  }
+
+  return type;
+}
+
+StubFileInfo *
+stub_file_info_new(const gchar *filename, gboolean is_directory) {
+  StubFileInfo *file = g_object_new(STUB_TYPE_FILE_INFO, NULL);
+
+  file->uri = g_filename_to_uri(filename, NULL, NULL);
+  file->is_directory = is_directory;
+  return file;
+}
+
+gboolean
+stub_file_info_has_emblem(StubFileInfo *file, const gchar *emblem) {
+  guint i;
+
+  for (i = 0; i < file->emblems->len; i++) {
+    if (strcmp(g_ptr_array_index(file->emblems, i), emblem) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* nautilus_info_provider_update_complete_invoke passes the provider,
+   the handle and the result */
+static void
+marshal_update_complete(GClosure *closure, GValue *return_value,
+			guint n_param_values, const GValue *param_values,
+			gpointer invocation_hint, gpointer marshal_data) {
+  StubUpdateComplete callback =
+    (StubUpdateComplete) ((GCClosure *) closure)->callback;
+
+  g_assert(n_param_values == 3);
+  callback(closure->data,
+	   (NautilusOperationHandle *) g_value_get_pointer(&(param_values[1])),
+	   (NautilusOperationResult) g_value_get_enum(&(param_values[2])));
+}
+
+GClosure *
+stub_update_complete_new(StubUpdateComplete callback, gpointer data,
+			 GClosureNotify destroy) {
+  GClosure *closure = g_cclosure_new(G_CALLBACK(callback), data, destroy);
+
+  g_closure_set_marshal(closure, marshal_update_complete);
+  /* owned by whoever calls update_file_info, like nautilus does */
+  g_closure_ref(closure);
+  g_closure_sink(closure);
+  return closure;
+}
+
+/* nautilus loads the extension as a module, any module will do */
+
+typedef GTypeModule      StubModule;
+typedef GTypeModuleClass StubModuleClass;
+
+static gboolean
+stub_module_load(GTypeModule *module) {
+  return TRUE;
+}
+
+static void
+stub_module_unload(GTypeModule *module) {
+}
+
+static void
+stub_module_class_init(StubModuleClass *class) {
+  class->load = stub_module_load;
+  class->unload = stub_module_unload;
+}
+
+static GType
+stub_module_get_type(void) {
+  static GType type = 0;
+
+  if (type == 0) {
+    static const GTypeInfo info = {
+      sizeof (StubModuleClass),
+      (GBaseInitFunc) NULL,
+      (GBaseFinalizeFunc) NULL,
+      (GClassInitFunc) stub_module_class_init,
+      (GClassFinalizeFunc) NULL,
+      NULL,
+      sizeof (StubModule),
+      0,
+      (GInstanceInitFunc) NULL,
+    };
+
+    type = g_type_register_static(G_TYPE_TYPE_MODULE, "StubModule", &info, 0);
+  }
+
+  return type;
+}
+
+static void
+drop_log(const gchar *log_domain, GLogLevelFlags log_level,
+	 const gchar *message, gpointer user_data) {
+}
+
+NautilusDropbox *
+stub_provider_new(void) {
+  GTypeModule *module;
+
+  /* add_emblem_paths asks gtk for the icon theme, which it can only
+     complain about without a display */
+  if (!gtk_init_check(NULL, NULL)) {
+    g_log_set_handler("Gtk", G_LOG_LEVEL_CRITICAL, drop_log, NULL);
+  }
+
+  module = g_object_new(stub_module_get_type(), NULL);
+  g_type_module_use(module);
+  nautilus_dropbox_register_type(module);
+
+  /* dropbox.c turns this on so nautilus doesn't wait on us, the tests
+     want to see the update_complete closures fire */
+  dropbox_use_operation_in_progress_workaround = FALSE;
+
+  return g_object_new(NAUTILUS_TYPE_DROPBOX, NULL);
+}
+
+gboolean
+stub_provider_ready(NautilusDropbox *cvs) {
+  return dropbox_client_is_connected(&(cvs->dc)) && cvs->root_paths != NULL;
+}
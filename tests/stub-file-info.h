@@ -0,0 +1,80 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * stub-file-info.h
+ * Stand-in nautilus file objects for driving the extension in tests.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STUB_FILE_INFO_H
+#define STUB_FILE_INFO_H
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include <libnautilus-extension/nautilus-file-info.h>
+#include <libnautilus-extension/nautilus-info-provider.h>
+
+#include "nautilus-dropbox.h"
+
+G_BEGIN_DECLS
+
+/* Just enough of a NautilusFileInfo for the provider: a uri, whether
+   it's a directory, and a record of what the provider did to it. */
+
+#define STUB_TYPE_FILE_INFO	  (stub_file_info_get_type ())
+#define STUB_FILE_INFO(o)	  (G_TYPE_CHECK_INSTANCE_CAST ((o), STUB_TYPE_FILE_INFO, StubFileInfo))
+typedef struct _StubFileInfo      StubFileInfo;
+typedef struct _StubFileInfoClass StubFileInfoClass;
+
+struct _StubFileInfo {
+  GObject parent_slot;
+  gchar *uri;
+  gboolean is_directory;
+  gboolean is_gone;
+  GPtrArray *emblems;         /* added since the last invalidate */
+  guint invalidated;          /* invalidate_extension_info calls */
+};
+
+struct _StubFileInfoClass {
+  GObjectClass parent_slot;
+};
+
+typedef void (*StubUpdateComplete) (gpointer data,
+				    NautilusOperationHandle *handle,
+				    NautilusOperationResult result);
+
+GType         stub_file_info_get_type(void);
+StubFileInfo *stub_file_info_new(const gchar *filename, gboolean is_directory);
+gboolean      stub_file_info_has_emblem(StubFileInfo *file, const gchar *emblem);
+
+/* a closure like the one nautilus passes update_file_info */
+GClosure *stub_update_complete_new(StubUpdateComplete callback, gpointer data,
+				   GClosureNotify destroy);
+
+/* registers NautilusDropbox and makes one, it connects to the daemon
+   under $HOME like it does in nautilus */
+NautilusDropbox *stub_provider_new(void);
+
+/* connected and told where the Dropbox folder is, until then every file
+   looks like it's in Dropbox */
+gboolean stub_provider_ready(NautilusDropbox *cvs);
+
+G_END_DECLS
+
+#endif
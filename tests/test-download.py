@@ -0,0 +1,143 @@
+#!/usr/bin/env python
+#
+# Copyright 2008 Evenflow, Inc.
+#
+# test-download.py
+# Checks the dropbox CLI's ranged download against a flaky server.
+#
+# This file is part of nautilus-dropbox.
+#
+# nautilus-dropbox is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# nautilus-dropbox is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Run by "make check" as test-download.py TOP_SRCDIR.  Loads
+# download_file_ranged out of dropbox.in and points it at
+# mock-download-server.py, which cuts 30% of responses short:
+#
+# - a download killed partway and then resumed has to come out byte
+#   identical, from the .state file the killed one left behind
+# - a resume after the server started serving a different file (new
+#   ETag) has to start over and get the new one
+# - a server without range support has to get the single stream
+
+import imp
+import os
+import shutil
+import sys
+import tempfile
+import threading
+import time
+
+SIZE = 3 * 1024 * 1024 + 17
+
+def load(path, name):
+    return imp.load_source(name, path)
+
+def load_dropbox(path):
+    # dropbox.in is a template, fill in just enough to import it
+    with open(path) as f:
+        source = f.read()
+    for key, value in [('@IMAGEDATA64@', 'None'), ('@IMAGEDATA16@', 'None'),
+                       ('@PACKAGE_VERSION@', 'test'), ('@DESKTOP_FILE_DIR@', '/tmp')]:
+        source = source.replace(key, value)
+    dropbox = imp.new_module('dropbox')
+    dropbox.__file__ = path
+    exec compile(source, path, 'exec') in dropbox.__dict__
+
+    # retries back off for up to 30s, that's for real servers
+    class FastTime(object):
+        def __getattr__(self, name):
+            return getattr(time, name)
+        def sleep(self, seconds):
+            time.sleep(min(seconds, 0.05))
+    dropbox.time = FastTime()
+    return dropbox
+
+def run(dropbox, url, path, stop_at=None):
+    for progress, ok in dropbox.download_file_ranged(url, path):
+        if stop_at is not None and progress >= stop_at:
+            return False
+    return True
+
+def kill_partway(dropbox, url, path):
+    # the download threads write behind our back, so die like a real
+    # ^C would, in a child, instead of just dropping the generator
+    pid = os.fork()
+    if pid == 0:
+        try:
+            run(dropbox, url, path, stop_at=0.4)
+        finally:
+            os._exit(0)
+    os.waitpid(pid, 0)
+
+def downloaded(path):
+    # bytes the .state file says are done, each range is "start done end"
+    try:
+        with open(path + '.state') as f:
+            lines = f.read().splitlines()[2:]
+    except IOError:
+        return 0
+    return sum(int(line.split()[1]) - int(line.split()[0]) for line in lines)
+
+def check(what, ok):
+    print "%s: %s" % (what, "ok" if ok else "FAILED")
+    return ok
+
+def main(argv):
+    top_srcdir = argv[1] if len(argv) > 1 else os.path.join(os.path.dirname(__file__), '..')
+    mock = load(os.path.join(top_srcdir, 'mock-download-server.py'), 'mock_download_server')
+    dropbox = load_dropbox(os.path.join(top_srcdir, 'dropbox.in'))
+
+    server = mock.MockDownloadServer(0, mock.random_blob(SIZE), cut_rate=0.3,
+                                     delay=0.001)
+    t = threading.Thread(target=server.serve_forever)
+    t.setDaemon(True)
+    t.start()
+
+    tmp = tempfile.mkdtemp()
+    path = os.path.join(tmp, 'dropbox-dist.download')
+    good = True
+    try:
+        kill_partway(dropbox, server.url(), path)
+        good &= check("killed download left its progress",
+                      downloaded(path) > 0)
+        run(dropbox, server.url(), path)
+        good &= check("resumed download is byte identical",
+                      open(path, 'rb').read() == server.data)
+        good &= check("state is gone after a finished download",
+                      not os.path.exists(path + '.state'))
+
+        kill_partway(dropbox, server.url(), path)
+        server.data = mock.random_blob(SIZE - 1000, seed=1)
+        server.etag = 'v2'
+        run(dropbox, server.url(), path)
+        good &= check("new ETag starts over",
+                      open(path, 'rb').read() == server.data)
+
+        server.ranges = False
+        server.cut_rate = 0.0
+        server.data = mock.random_blob(SIZE // 3, seed=2)
+        run(dropbox, server.url(), path)
+        good &= check("server without ranges gets a single stream",
+                      open(path, 'rb').read() == server.data)
+    finally:
+        shutil.rmtree(tmp)
+        server.shutdown()
+
+    print "%d responses, %d cut short" % (server.served, server.cuts)
+    good &= check("some responses were cut short", server.cuts > 0)
+    return 0 if good else 1
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
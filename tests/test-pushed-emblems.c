@@ -0,0 +1,288 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * test-pushed-emblems.c
+ * Checks the extension answers nautilus from shell_emblems pushes.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+  Run by "make check" against mock-dropboxd.py --push-emblems, which
+  pushes shell_emblems for more ~/Dropbox/file-N than this shows.  This
+  goes through the provider the way nautilus does:
+
+  - it shows file-0 .. file-(SHOWN_FILES - 1) and waits for the daemon to
+    answer each of them
+  - when handle_shell_emblems invalidates one of them it asks again, and
+    update_file_info has to answer on the spot with the pushed emblem and
+    without queueing a command
+  - once, it renames a file that has pushed emblems and shows a new file
+    under the old name, which must not get the old file's emblems
+  - at the end only files it shows may have pushed emblems remembered
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "dropbox-log.h"
+#include "stub-file-info.h"
+
+#define SHOWN_FILES 40
+#define WANT_ANSWERS 200
+
+typedef struct {
+  NautilusDropbox *cvs;
+  GMainLoop *loop;
+  StubFileInfo *files[SHOWN_FILES];
+  guint seen_invalidated[SHOWN_FILES];
+  gboolean watching[SHOWN_FILES];
+  GSList *renamed;
+  guint shown;
+  guint answered;
+  gboolean settled;
+  guint from_pushes;
+  gboolean renamed_one;
+  guint bad;
+} Test;
+
+static Test test;
+
+static gchar *
+file_name(guint i) {
+  gchar *basename = g_strdup_printf("file-%u", i);
+  gchar *filename = g_build_filename(g_get_home_dir(), "Dropbox", basename, NULL);
+
+  g_free(basename);
+  return filename;
+}
+
+static void
+fail(Test *t, const gchar *why, guint i) {
+  g_printerr("file-%u: %s\n", i, why);
+  t->bad++;
+}
+
+static void
+shown_complete(Test *t, NautilusOperationHandle *handle,
+	       NautilusOperationResult result) {
+  if (result != NAUTILUS_OPERATION_COMPLETE) {
+    g_printerr("the daemon didn't answer a file info request\n");
+    t->bad++;
+  }
+  t->answered++;
+}
+
+/* for requests whose answer doesn't matter, the checks look at what
+   update_file_info returned */
+static void
+ignore_complete(Test *t, NautilusOperationHandle *handle,
+		NautilusOperationResult result) {
+}
+
+static NautilusOperationResult
+show(Test *t, StubFileInfo *file, StubUpdateComplete callback,
+     NautilusOperationHandle **handle) {
+  NautilusOperationResult result;
+  GClosure *closure;
+
+  closure = stub_update_complete_new(callback, t, NULL);
+  *handle = NULL;
+  result = nautilus_info_provider_update_file_info(NAUTILUS_INFO_PROVIDER(t->cvs),
+						   NAUTILUS_FILE_INFO(file),
+						   closure, handle);
+  g_closure_unref(closure);
+  return result;
+}
+
+/* file i has pushed emblems, so a file that takes over its name mustn't */
+static void
+check_rename(Test *t, guint i) {
+  StubFileInfo *file = t->files[i], *newcomer;
+  NautilusOperationHandle *handle;
+  gchar *filename, *renamed;
+
+  filename = file_name(i);
+  renamed = g_strconcat(filename, "-renamed", NULL);
+
+  /* nautilus reuses the file object for the new name */
+  g_free(file->uri);
+  file->uri = g_filename_to_uri(renamed, NULL, NULL);
+  show(t, file, (StubUpdateComplete) ignore_complete, &handle);
+  t->renamed = g_slist_prepend(t->renamed, file);
+
+  newcomer = stub_file_info_new(filename, FALSE);
+  if (show(t, newcomer, (StubUpdateComplete) ignore_complete,
+	   &handle) != NAUTILUS_OPERATION_IN_PROGRESS) {
+    fail(t, "a new file under a renamed file's name got its pushed emblems", i);
+  }
+  t->files[i] = newcomer;
+  t->watching[i] = FALSE;
+  t->renamed_one = TRUE;
+
+  g_free(renamed);
+  g_free(filename);
+}
+
+static void
+ask_again(Test *t, guint i) {
+  StubFileInfo *file = t->files[i];
+  NautilusOperationHandle *handle;
+  const gchar *emblem;
+
+  if (show(t, file, (StubUpdateComplete) ignore_complete,
+	   &handle) != NAUTILUS_OPERATION_COMPLETE || handle != NULL) {
+    fail(t, "invalidated by a push but queued a command", i);
+    t->watching[i] = FALSE;
+    return;
+  }
+
+  if (file->emblems->len != 1) {
+    fail(t, "want exactly the pushed emblem", i);
+    return;
+  }
+
+  emblem = g_ptr_array_index(file->emblems, 0);
+  if (!g_str_has_prefix(emblem, "mock-emblem-") ||
+      strlen(emblem) != strlen("mock-emblem-0") ||
+      emblem[12] < '0' || emblem[12] > '3') {
+    fail(t, "not a pushed emblem", i);
+    return;
+  }
+
+  t->from_pushes++;
+  if (!t->renamed_one) {
+    check_rename(t, i);
+  }
+}
+
+/* nautilus asks again about the files an extension invalidates */
+static gboolean
+watch(Test *t) {
+  guint i;
+
+  if (t->answered < t->shown) {
+    return TRUE;
+  }
+
+  /* a push that invalidated a file while its first answer was on the
+     way doesn't count, the answer added to what the push left */
+  if (!t->settled) {
+    for (i = 0; i < SHOWN_FILES; i++) {
+      t->seen_invalidated[i] = t->files[i]->invalidated;
+      t->watching[i] = TRUE;
+    }
+    t->settled = TRUE;
+    return TRUE;
+  }
+
+  for (i = 0; i < SHOWN_FILES; i++) {
+    if (t->watching[i] && t->files[i]->invalidated != t->seen_invalidated[i]) {
+      t->seen_invalidated[i] = t->files[i]->invalidated;
+      ask_again(t, i);
+    }
+  }
+
+  if (t->from_pushes >= WANT_ANSWERS) {
+    g_main_loop_quit(t->loop);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+wait_for_provider(Test *t) {
+  guint i;
+
+  if (!stub_provider_ready(t->cvs))
+    return TRUE;
+
+  for (i = 0; i < SHOWN_FILES; i++) {
+    gchar *filename = file_name(i);
+    NautilusOperationHandle *handle;
+
+    t->files[i] = stub_file_info_new(filename, FALSE);
+    g_free(filename);
+
+    t->shown++;
+    if (show(t, t->files[i], (StubUpdateComplete) shown_complete,
+	     &handle) != NAUTILUS_OPERATION_IN_PROGRESS) {
+      fail(t, "wasn't asked about", i);
+      t->answered++;
+    }
+  }
+
+  g_timeout_add(10, (GSourceFunc) watch, t);
+  return FALSE;
+}
+
+static void
+check_remembered(gchar *filename, gchar **emblems, Test *t) {
+  if (g_hash_table_lookup(t->cvs->filename2obj, filename) == NULL) {
+    g_printerr("%s: pushed emblems remembered for a file nobody shows\n",
+	       filename);
+    t->bad++;
+  }
+}
+
+static gboolean
+on_timeout(Test *t) {
+  g_printerr("only %u of %u answers came from pushes\n",
+	     t->from_pushes, WANT_ANSWERS);
+  exit(1);
+  return FALSE;
+}
+
+int
+main(int argc, char **argv) {
+  GSList *l;
+  guint i;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+  if (!g_thread_supported())
+    g_thread_init(NULL);
+#endif
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+  g_type_init();
+#endif
+  dropbox_log_init();
+
+  test.loop = g_main_loop_new(NULL, FALSE);
+  test.cvs = stub_provider_new();
+
+  g_timeout_add(10, (GSourceFunc) wait_for_provider, &test);
+  g_timeout_add(30 * 1000, (GSourceFunc) on_timeout, &test);
+  g_main_loop_run(test.loop);
+
+  g_hash_table_foreach(test.cvs->pushed_emblems,
+		       (GHFunc) check_remembered, &test);
+
+  g_print("%u answered from pushes, %u bad\n", test.from_pushes, test.bad);
+
+  for (i = 0; i < SHOWN_FILES; i++) {
+    g_object_unref(test.files[i]);
+  }
+  for (l = test.renamed; l != NULL; l = l->next) {
+    g_object_unref(l->data);
+  }
+  g_slist_free(test.renamed);
+
+  return (test.bad == 0 && test.renamed_one) ? 0 : 1;
+}
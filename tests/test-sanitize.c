@@ -0,0 +1,575 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * test-sanitize.c
+ * Checks the protocol escaping and argument line parsing against the
+ * GLib functions they replaced.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+  dropbox_client_util_sanitize used to be g_strescape() with every byte
+  but '\\', '\n' and '\t' in the exceptions, so that is the reference
+  here.  The SSE2 scan looks at 16 bytes at a time and finishes the tail
+  one byte at a time, so every length up to a few chunks gets a special
+  byte in every position, at every alignment.
+
+  Argument lines used to be g_strsplit() at the tabs and every field run
+  through g_strcompress(); now they're split in place and only fields
+  with a backslash get decoded, in place.  Those are checked against the
+  old way too, trailing backslashes and octal escapes included.
+
+  With -b it times the old and new versions instead, splitting lines of
+  1, 10 and 1000 values.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "dropbox-args.h"
+#include "dropbox-client-util.h"
+
+/* from the original dropbox-client-util.c */
+static gchar chars_not_to_escape[] = {
+  1, 2, 3, 4, 5, 6, 7, 8, 11, 12,
+  13, 14, 15, 16, 17, 18, 19, 20, 21, 22,
+  23, 24, 25, 26, 27, 28, 29, 30, 31, 34, 127,
+  -128, -127, -126, -125, -124, -123, -122, -121, -120, -119,
+  -118, -117, -116, -115, -114, -113, -112, -111, -110, -109,
+  -108, -107, -106, -105, -104, -103, -102, -101, -100, -99,
+  -98, -97, -96, -95, -94, -93, -92, -91, -90, -89,
+  -88, -87, -86, -85, -84, -83, -82, -81, -80, -79,
+  -78, -77, -76, -75, -74, -73, -72, -71, -70, -69,
+  -68, -67, -66, -65, -64, -63, -62, -61, -60, -59,
+  -58, -57, -56, -55, -54, -53, -52, -51, -50, -49,
+  -48, -47, -46, -45, -44, -43, -42, -41, -40, -39,
+  -38, -37, -36, -35, -34, -33, -32, -31, -30, -29,
+  -28, -27, -26, -25, -24, -23, -22, -21, -20, -19,
+  -18, -17, -16, -15, -14, -13, -12, -11, -10, -9,
+  -8, -7, -6, -5, -4, -3, -2, -1, 0
+};
+
+static const gchar specials[] = {'\\', '\n', '\t'};
+
+static guint checks = 0;
+static guint failures = 0;
+
+static void
+print_escaped(const gchar *label, const gchar *s) {
+  /* escape everything so the output shows what really differs */
+  gchar *e = g_strescape(s, NULL);
+  g_printerr("  %s \"%s\"\n", label, e);
+  g_free(e);
+}
+
+static void
+check_sanitize(const gchar *a) {
+  gchar *want = g_strescape(a, chars_not_to_escape);
+  gchar *got = dropbox_client_util_sanitize(a);
+  gchar *allocated;
+  const gchar *borrowed = dropbox_client_util_sanitize_borrowed(a, &allocated);
+  gboolean clean = strcmp(want, a) == 0;
+
+  checks++;
+  if (strcmp(want, got) != 0 || strcmp(want, borrowed) != 0 ||
+      (clean ? (borrowed != a || allocated != NULL) :
+       (allocated == NULL || borrowed != allocated))) {
+    failures++;
+    g_printerr("sanitize mismatch:\n");
+    print_escaped("input", a);
+    print_escaped("want", want);
+    print_escaped("got", got);
+    print_escaped("borrowed", borrowed);
+  }
+
+  g_free(allocated);
+  g_free(got);
+  g_free(want);
+}
+
+/* every length up to four chunks, a special byte at every position, the
+   string starting at every offset into a chunk */
+static void
+test_sanitize_boundaries(void) {
+  gchar buf[16 + 64 + 1];
+  guint len, pos, offset, s;
+
+  for (offset = 0; offset < 16; offset++) {
+    gchar *a = buf + offset;
+
+    for (len = 0; len <= 64; len++) {
+      memset(a, 'x', len);
+      a[len] = '\0';
+      check_sanitize(a);
+
+      for (pos = 0; pos < len; pos++) {
+	for (s = 0; s < G_N_ELEMENTS(specials); s++) {
+	  a[pos] = specials[s];
+	  check_sanitize(a);
+	  /* and one more in the tail */
+	  a[len - 1] = specials[(s + 1) % G_N_ELEMENTS(specials)];
+	  check_sanitize(a);
+	  memset(a, 'x', len);
+	}
+      }
+    }
+  }
+}
+
+/* every byte value next to every special, nothing but '\\', '\n' and '\t'
+   may be touched */
+static void
+test_sanitize_all_bytes(void) {
+  gchar a[40];
+  guint c, s, pos;
+
+  for (c = 1; c < 256; c++) {
+    for (s = 0; s < G_N_ELEMENTS(specials); s++) {
+      for (pos = 0; pos < 20; pos++) {
+	memset(a, c, sizeof(a) - 1);
+	a[sizeof(a) - 1] = '\0';
+	a[pos] = specials[s];
+	check_sanitize(a);
+      }
+    }
+  }
+}
+
+static void
+random_string(GRand *rand, gchar *a, guint len) {
+  guint i;
+
+  for (i = 0; i < len; i++) {
+    switch (g_rand_int_range(rand, 0, 8)) {
+    case 0:
+      a[i] = specials[g_rand_int_range(rand, 0, G_N_ELEMENTS(specials))];
+      break;
+    case 1:
+      a[i] = (gchar) g_rand_int_range(rand, 1, 256);
+      break;
+    default:
+      a[i] = (gchar) g_rand_int_range(rand, 'a', 'z' + 1);
+      break;
+    }
+  }
+  a[len] = '\0';
+}
+
+static void
+test_sanitize_random(void) {
+  GRand *rand = g_rand_new_with_seed(20081018);
+  gchar a[256];
+  guint i;
+
+  for (i = 0; i < 20000; i++) {
+    random_string(rand, a, g_rand_int_range(rand, 0, sizeof(a)));
+    check_sanitize(a);
+  }
+
+  g_rand_free(rand);
+}
+
+/* g_strcompress() warns about a trailing backslash and then drops it,
+   which is what we do without the warning */
+static gchar *
+old_desanitize(const gchar *a) {
+  gsize len = strlen(a), n = 0;
+  gchar *trimmed, *toret;
+
+  while (n < len && a[len - 1 - n] == '\\')
+    n++;
+  if (n % 2 == 0)
+    return g_strcompress(a);
+
+  trimmed = g_strndup(a, len - 1);
+  toret = g_strcompress(trimmed);
+  g_free(trimmed);
+  return toret;
+}
+
+static void
+check_desanitize(const gchar *a) {
+  gchar *want = old_desanitize(a);
+  gchar *got = dropbox_client_util_desanitize(a);
+  gchar *in_place = g_strdup(a);
+
+  dropbox_client_util_desanitize_in_place(in_place);
+
+  checks++;
+  if (strcmp(want, got) != 0 || strcmp(want, in_place) != 0) {
+    failures++;
+    g_printerr("desanitize mismatch:\n");
+    print_escaped("input", a);
+    print_escaped("want", want);
+    print_escaped("got", got);
+    print_escaped("in place", in_place);
+  }
+
+  g_free(in_place);
+  g_free(got);
+  g_free(want);
+}
+
+/* every escape the daemon could send and some it shouldn't, at every
+   position, plus a lone backslash at the end */
+static void
+test_desanitize_escapes(void) {
+  static const gchar *octal[] = {
+    "\\0", "\\7", "\\12", "\\101", "\\1012", "\\777", "\\8", "\\18", "\\0x"
+  };
+  gchar a[48];
+  guint c, len, pos, i;
+
+  for (len = 2; len <= 40; len++) {
+    for (pos = 0; pos + 2 <= len; pos++) {
+      for (c = 1; c < 256; c++) {
+	memset(a, 'x', len);
+	a[len] = '\0';
+	a[pos] = '\\';
+	a[pos + 1] = c;
+	check_desanitize(a);
+      }
+      for (i = 0; i < G_N_ELEMENTS(octal); i++) {
+	gsize n = strlen(octal[i]);
+
+	if (pos + n <= len) {
+	  memset(a, 'x', len);
+	  a[len] = '\0';
+	  memcpy(a + pos, octal[i], n);
+	  check_desanitize(a);
+	}
+      }
+    }
+  }
+
+  for (len = 0; len <= 40; len++) {
+    for (i = 1; i <= 3 && i <= len; i++) {
+      /* one, two or three backslashes at the end */
+      memset(a, 'x', len);
+      memset(a + len - i, '\\', i);
+      a[len] = '\0';
+      check_desanitize(a);
+    }
+  }
+}
+
+static void
+test_desanitize_random(void) {
+  GRand *rand = g_rand_new_with_seed(20081019);
+  gchar a[256];
+  guint i;
+
+  for (i = 0; i < 20000; i++) {
+    gchar *escaped, *back;
+
+    random_string(rand, a, g_rand_int_range(rand, 0, sizeof(a)));
+    check_desanitize(a);
+
+    /* and whatever we send has to come back the same */
+    escaped = dropbox_client_util_sanitize(a);
+    back = g_strdup(escaped);
+    dropbox_client_util_desanitize_in_place(back);
+    checks++;
+    if (strcmp(back, a) != 0) {
+      failures++;
+      g_printerr("round trip mismatch:\n");
+      print_escaped("input", a);
+      print_escaped("got", back);
+    }
+    g_free(back);
+    g_free(escaped);
+  }
+
+  g_rand_free(rand);
+}
+
+/* what dropbox_client_util_command_parse_arg did before */
+static gboolean
+old_parse_line(const gchar *line, gchar **key, gchar ***vals) {
+  gchar **argval = g_strsplit(line, "\t", 0);
+  guint len = g_strv_length(argval), i;
+
+  if (len <= 1) {
+    g_strfreev(argval);
+    return FALSE;
+  }
+
+  *key = old_desanitize(argval[0]);
+  *vals = g_new(gchar *, len);
+  for (i = 1; i < len; i++) {
+    (*vals)[i - 1] = old_desanitize(argval[i]);
+  }
+  (*vals)[len - 1] = NULL;
+
+  g_strfreev(argval);
+  return TRUE;
+}
+
+static void
+check_parse_line(const gchar *line) {
+  DropboxArgs *args = dropbox_args_new();
+  gchar *key = NULL, **want = NULL, **got = NULL;
+  gboolean want_ok = old_parse_line(line, &key, &want);
+  gboolean got_ok = dropbox_args_parse_line(args, line);
+  gboolean same = want_ok == got_ok;
+  guint i;
+
+  if (same && want_ok) {
+    got = dropbox_args_lookup(args, key);
+    same = got != NULL && g_strv_length(got) == g_strv_length(want);
+    for (i = 0; same && want[i] != NULL; i++) {
+      same = strcmp(want[i], got[i]) == 0;
+    }
+  }
+
+  checks++;
+  if (!same) {
+    failures++;
+    g_printerr("parse mismatch (%s, %s):\n", want_ok ? "ok" : "bad",
+	       got_ok ? "ok" : "bad");
+    print_escaped("line", line);
+  }
+
+  g_free(key);
+  g_strfreev(want);
+  dropbox_args_unref(args);
+}
+
+/* split_arg leaves the fields escaped, but has to find the same ones */
+static void
+check_split_arg(const gchar *line) {
+  gchar **want = g_strsplit(line, "\t", 0);
+  gchar *copy = g_strdup(line);
+  gchar *fields[DROPBOX_ARGS_MAX];
+  guint n = dropbox_client_util_command_split_arg(copy, fields,
+						  G_N_ELEMENTS(fields));
+  guint want_n = g_strv_length(want);
+  gboolean same;
+  guint i;
+
+  /* an empty line is one empty field to us, none to g_strsplit */
+  if (line[0] == '\0')
+    same = n == 1 && fields[0][0] == '\0';
+  else if (want_n > G_N_ELEMENTS(fields))
+    same = n == 0;
+  else
+    same = n == want_n;
+  for (i = 0; same && n > 0 && line[0] != '\0' && i < n; i++) {
+    same = strcmp(want[i], fields[i]) == 0;
+  }
+
+  checks++;
+  if (!same) {
+    failures++;
+    g_printerr("split mismatch (%u fields, want %u):\n", n, want_n);
+    print_escaped("line", line);
+  }
+
+  g_free(copy);
+  g_strfreev(want);
+}
+
+static void
+test_parse_random(void) {
+  GRand *rand = g_rand_new_with_seed(20081020);
+  gchar line[512];
+  guint i;
+
+  for (i = 0; i < 20000; i++) {
+    guint len = g_rand_int_range(rand, 0, 64), j;
+
+    /* mostly escaped fields separated by tabs, sometimes a lot of them */
+    random_string(rand, line, len);
+    for (j = 0; j < len; j++) {
+      if (line[j] == '\n')
+	line[j] = 'n';
+    }
+    if (i % 50 == 0) {
+      for (j = 0; j < len; j += 2)
+	line[j] = '\t';
+    }
+
+    check_split_arg(line);
+    check_parse_line(line);
+  }
+
+  g_rand_free(rand);
+}
+
+/* a few file names like the ones the extension sends */
+static const gchar *bench_names[] = {
+  "/home/user/Dropbox/Photos/2008/Summer/IMG_1234.JPG",
+  "/home/user/Dropbox/Projects/nautilus-dropbox/src/dropbox-client-util.c",
+  "/home/user/Dropbox/a",
+  "/home/user/Dropbox/Music/Some Artist - Some Album (Deluxe Edition)/07 - Track Seven.mp3",
+  "/home/user/Dropbox/odd\tname\\with\nspecials",
+};
+
+static gdouble
+time_it(const gchar *label, gchar *(*f)(const gchar *), guint rounds) {
+  GTimer *timer = g_timer_new();
+  gdouble ns;
+  guint i, j;
+
+  for (i = 0; i < rounds; i++) {
+    for (j = 0; j < G_N_ELEMENTS(bench_names); j++) {
+      g_free(f(bench_names[j]));
+    }
+  }
+
+  ns = g_timer_elapsed(timer, NULL) * 1e9 / (rounds * G_N_ELEMENTS(bench_names));
+  g_timer_destroy(timer);
+  g_print("%-24s %6.1f ns/string\n", label, ns);
+  return ns;
+}
+
+static gchar *
+old_sanitize(const gchar *a) {
+  return g_strescape(a, chars_not_to_escape);
+}
+
+static gchar *
+borrow_sanitize(const gchar *a) {
+  gchar *allocated;
+
+  dropbox_client_util_sanitize_borrowed(a, &allocated);
+  return allocated;
+}
+
+/* argument lines like the daemon sends, one per starting name so some
+   have escaped values even with a single value per line */
+static gchar **
+bench_lines(guint values, gsize *longest) {
+  gchar **lines = g_new0(gchar *, G_N_ELEMENTS(bench_names) + 1);
+  guint i, j;
+
+  *longest = 0;
+  for (i = 0; i < G_N_ELEMENTS(bench_names); i++) {
+    GString *line = g_string_new(NULL);
+
+    for (j = 0; j < values; j++) {
+      gchar *value =
+	dropbox_client_util_sanitize(bench_names[(i + j) % G_N_ELEMENTS(bench_names)]);
+
+      if (j > 0)
+	g_string_append_c(line, '\t');
+      g_string_append(line, value);
+      g_free(value);
+    }
+    *longest = MAX(*longest, line->len);
+    lines[i] = g_string_free(line, FALSE);
+  }
+
+  return lines;
+}
+
+static void
+old_split_and_compress(const gchar *line) {
+  gchar **fields = g_strsplit(line, "\t", 0), **p;
+
+  for (p = fields; *p != NULL; p++) {
+    g_free(g_strcompress(*p));
+  }
+  g_strfreev(fields);
+}
+
+/* the real thing splits the line where the reader read it, the copy
+   stands in for the read */
+static void
+split_and_desanitize(const gchar *line, gchar *buf, gchar **fields,
+		     guint max_fields) {
+  guint n, i;
+
+  strcpy(buf, line);
+  n = dropbox_client_util_command_split_arg(buf, fields, max_fields);
+  g_assert(n > 0);
+  for (i = 0; i < n; i++) {
+    if (strchr(fields[i], '\\') != NULL)
+      dropbox_client_util_desanitize_in_place(fields[i]);
+  }
+}
+
+static void
+time_split(guint values, guint rounds) {
+  gsize longest;
+  gchar **lines = bench_lines(values, &longest);
+  gchar *buf = g_malloc(longest + 1);
+  gchar **fields = g_new(gchar *, values);
+  GTimer *timer;
+  gdouble old_ns, new_ns, n;
+  guint i, j;
+
+  rounds = MAX(rounds / values, 1);
+  n = (gdouble) rounds * G_N_ELEMENTS(bench_names);
+
+  timer = g_timer_new();
+  for (i = 0; i < rounds; i++) {
+    for (j = 0; lines[j] != NULL; j++) {
+      old_split_and_compress(lines[j]);
+    }
+  }
+  old_ns = g_timer_elapsed(timer, NULL) * 1e9 / n;
+
+  g_timer_start(timer);
+  for (i = 0; i < rounds; i++) {
+    for (j = 0; lines[j] != NULL; j++) {
+      split_and_desanitize(lines[j], buf, fields, values);
+    }
+  }
+  new_ns = g_timer_elapsed(timer, NULL) * 1e9 / n;
+  g_timer_destroy(timer);
+
+  g_print("%-24s %4u values %9.1f ns/line %6.1f ns/value\n",
+	  "g_strsplit+g_strcompress", values, old_ns, old_ns / values);
+  g_print("%-24s %4u values %9.1f ns/line %6.1f ns/value\n",
+	  "split_arg+in place", values, new_ns, new_ns / values);
+
+  g_free(fields);
+  g_free(buf);
+  g_strfreev(lines);
+}
+
+static void
+bench(guint rounds) {
+  time_it("g_strescape", old_sanitize, rounds);
+  time_it("sanitize", dropbox_client_util_sanitize, rounds);
+  time_it("sanitize_borrowed", borrow_sanitize, rounds);
+  time_split(1, rounds);
+  time_split(10, rounds);
+  time_split(1000, rounds);
+}
+
+int
+main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+    bench(argc > 2 ? strtoul(argv[2], NULL, 10) : 200000);
+    return 0;
+  }
+
+  test_sanitize_boundaries();
+  test_sanitize_all_bytes();
+  test_sanitize_random();
+  test_desanitize_escapes();
+  test_desanitize_random();
+  test_parse_random();
+
+  g_print("%u checks, %u failed\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}
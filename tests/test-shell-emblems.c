@@ -0,0 +1,175 @@
+/*
+ * Copyright 2008 Evenflow, Inc.
+ *
+ * test-shell-emblems.c
+ * Checks shell_emblems pushes make it through the hook connection intact.
+ *
+ * This file is part of nautilus-dropbox.
+ *
+ * nautilus-dropbox is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nautilus-dropbox is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with nautilus-dropbox.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+  Run by "make check" against mock-dropboxd.py --push-emblems
+  --odd-pushes, which pushes shell_emblems bursts over iface_socket where
+  some file names need escaping and some pushes have an empty path and no
+  emblems.  Every push has to reach the shell_emblems hook exactly as the
+  mock meant it, in the shape handle_shell_emblems in nautilus-dropbox.c
+  relies on.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "dropbox-log.h"
+#include "nautilus-dropbox-hooks.h"
+
+#define WANT_PUSHES 200
+
+typedef struct {
+  NautilusDropboxHookserv hookserv;
+  GMainLoop *loop;
+  gchar *root;
+  guint plain;
+  guint escaped;
+  guint empty;
+  guint bad;
+} Test;
+
+static Test test;
+
+static gboolean
+check_plain_name(const gchar *basename) {
+  const gchar *p;
+
+  if (strncmp(basename, "file-", 5) != 0 || basename[5] == '\0')
+    return FALSE;
+  for (p = basename + 5; *p != '\0'; p++) {
+    if (!g_ascii_isdigit(*p))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static void
+fail(const gchar *why, gchar **path, gchar **emblems) {
+  gchar *p = path != NULL ? g_strjoinv("|", path) : NULL;
+  gchar *e = emblems != NULL ? g_strjoinv("|", emblems) : NULL;
+
+  g_printerr("bad shell_emblems (%s): path [%s] emblems [%s]\n", why,
+	     p != NULL ? p : "(none)", e != NULL ? e : "(none)");
+  g_free(p);
+  g_free(e);
+  test.bad++;
+}
+
+static void
+on_shell_emblems(DropboxArgs *args, Test *t) {
+  gchar **path = dropbox_args_lookup(args, "path");
+  gchar **emblems = dropbox_args_lookup(args, "emblems");
+  gsize root_len = strlen(t->root);
+
+  if (path == NULL || emblems == NULL) {
+    fail("missing key", path, emblems);
+  }
+  else if (path[0] == NULL || path[1] != NULL ||
+	   emblems[0] == NULL || emblems[1] != NULL) {
+    fail("want one value each", path, emblems);
+  }
+  else if (path[0][0] == '\0') {
+    if (emblems[0][0] != '\0')
+      fail("empty path with emblems", path, emblems);
+    else
+      t->empty++;
+  }
+  else if (strncmp(path[0], t->root, root_len) != 0 ||
+	   path[0][root_len] != '/') {
+    fail("not under the root", path, emblems);
+  }
+  else if (!g_str_has_prefix(emblems[0], "mock-emblem-") ||
+	   strlen(emblems[0]) != strlen("mock-emblem-0") ||
+	   emblems[0][12] < '0' || emblems[0][12] > '3') {
+    fail("bad emblem", path, emblems);
+  }
+  else {
+    const gchar *basename = path[0] + root_len + 1;
+    const gchar *odd = strchr(basename, '\t');
+
+    if (odd == NULL && check_plain_name(basename)) {
+      t->plain++;
+    }
+    else if (odd != NULL && strcmp(odd, "\twith\nodd\\chars") == 0) {
+      gchar *plain = g_strndup(basename, odd - basename);
+
+      if (check_plain_name(plain))
+	t->escaped++;
+      else
+	fail("bad escaped name", path, emblems);
+      g_free(plain);
+    }
+    else {
+      fail("bad name", path, emblems);
+    }
+  }
+
+  if (t->plain + t->escaped + t->empty + t->bad >= WANT_PUSHES) {
+    g_main_loop_quit(t->loop);
+  }
+}
+
+static void
+on_shell_touch(DropboxArgs *args, Test *t) {
+  g_printerr("got a shell_touch, the mock should only push shell_emblems\n");
+  t->bad++;
+}
+
+static gboolean
+on_timeout(Test *t) {
+  g_printerr("only got %u of %u pushes\n",
+	     t->plain + t->escaped + t->empty + t->bad, WANT_PUSHES);
+  exit(1);
+  return FALSE;
+}
+
+int
+main(int argc, char **argv) {
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+  if (!g_thread_supported())
+    g_thread_init(NULL);
+#endif
+  dropbox_log_init();
+
+  test.loop = g_main_loop_new(NULL, FALSE);
+  test.root = g_build_filename(g_get_home_dir(), "Dropbox", NULL);
+
+  nautilus_dropbox_hooks_setup(&(test.hookserv));
+  nautilus_dropbox_hooks_add(&(test.hookserv), "shell_emblems",
+			     (DropboxUpdateHook) on_shell_emblems, &test);
+  nautilus_dropbox_hooks_add(&(test.hookserv), "shell_touch",
+			     (DropboxUpdateHook) on_shell_touch, &test);
+  nautilus_dropbox_hooks_start(&(test.hookserv));
+
+  g_timeout_add(30 * 1000, (GSourceFunc) on_timeout, &test);
+  g_main_loop_run(test.loop);
+
+  g_print("%u plain, %u escaped, %u empty, %u bad\n",
+	  test.plain, test.escaped, test.empty, test.bad);
+
+  /* a burst has all three kinds, so there's no excuse for missing one */
+  return (test.bad == 0 && test.plain > 0 && test.escaped > 0 &&
+	  test.empty > 0) ? 0 : 1;
+}